@@ -179,6 +179,7 @@ extern double   vorbis_granule_time(vorbis_dsp_state *v,
                                     ogg_int64_t granulepos);
 
 extern const char *vorbis_version_string(void);
+extern void     vorbis_cache_clear(void);
 
 /* Vorbis PRIMITIVES: analysis/DSP layer ****************************/
 
@@ -191,12 +192,23 @@ extern int      vorbis_analysis_headerout(vorbis_dsp_state *v,
                                           ogg_packet *op_code);
 extern float  **vorbis_analysis_buffer(vorbis_dsp_state *v,int vals);
 extern int      vorbis_analysis_wrote(vorbis_dsp_state *v,int vals);
+extern int      vorbis_analysis_write_interleaved_s16(vorbis_dsp_state *v,
+                                                      const short *pcm,
+                                                      int vals);
+extern int      vorbis_analysis_write_interleaved_s24(vorbis_dsp_state *v,
+                                                      const unsigned char *pcm,
+                                                      int vals);
+extern int      vorbis_analysis_write_interleaved_f32(vorbis_dsp_state *v,
+                                                      const float *pcm,
+                                                      int vals);
 extern int      vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb);
 extern int      vorbis_analysis(vorbis_block *vb,ogg_packet *op);
 
 extern int      vorbis_bitrate_addblock(vorbis_block *vb);
 extern int      vorbis_bitrate_flushpacket(vorbis_dsp_state *vd,
                                            ogg_packet *op);
+extern int      vorbis_analysis_packetout(vorbis_dsp_state *v,
+                                          ogg_packet *op);
 
 /* Vorbis PRIMITIVES: synthesis layer *******************************/
 extern int      vorbis_synthesis_idheader(ogg_packet *op);
@@ -377,6 +377,86 @@ struct ovectl_ratemanage2_arg {
  */
 #define OV_ECTL_COUPLING_SET         0x41
 
+/**
+ *  Returns the number of threads the encoder may use in the int pointed
+ *  to by arg.
+ *
+ * Argument: <tt>int *</tt>
+*/
+#define OV_ECTL_THREADS_GET          0x50
+
+/**
+ *  Sets the number of threads the encoder may use to the value pointed to
+ *  by arg.
+ *
+ * Argument: <tt>int *</tt>
+ *
+ *  1 [default] encodes on the calling thread only.  Larger values let
+ *  the encoder spread independent work across a pool of worker threads:
+ *  the candidate encodes made for bitrate management and, when encoding
+ *  through vorbis_analysis_packetout(), several blocks at once.  The
+ *  search for block boundaries also runs on a thread of its own, ahead
+ *  of the analysis, as input arrives through vorbis_analysis_wrote().
+ *  The encoded stream is identical for any setting.  Takes effect at
+ *  vorbis_analysis_init() and, unlike the other settings, may be changed
+ *  after vorbis_encode_setup_init().
+ */
+#define OV_ECTL_THREADS_SET          0x51
+
+/**
+ *  Returns the current encoder speed level in the int pointed to by arg.
+ *
+ * Argument: <tt>int *</tt>
+*/
+#define OV_ECTL_SPEED_GET            0x60
+
+/**
+ *  Sets the encoder speed level to the value pointed to by arg.
+ *
+ * Argument: <tt>int *</tt>
+ *
+ *  0 [default] runs the full psychoacoustic model.  Higher levels trade
+ *  some quality for encoding speed, each including the ones below it:
+ *  1 disables noise normalization, 2 estimates tonal masking from the
+ *  MDCT instead of a separate FFT, and 3 encodes long blocks only (no
+ *  envelope search) with a coarser floor fit.  Values above 3 are
+ *  treated as 3.  Must be set before vorbis_encode_setup_init().
+ */
+#define OV_ECTL_SPEED_SET            0x61
+
+/**
+ *  Returns the current low latency setting in the int pointed to by arg.
+ *
+ * Argument: <tt>int *</tt>
+*/
+#define OV_ECTL_LOWLATENCY_GET       0x70
+
+/**
+ *  Enables/disables low latency encoding according to arg.
+ *
+ * Argument: <tt>int *</tt>
+ *
+ *  Nonzero encodes short blocks only and skips the envelope search,
+ *  bounding the encoder's lookahead to one short block at some cost in
+ *  bitrate and quality.  Zero [default] restores normal block switching.
+ *  Must be set before vorbis_encode_setup_init().
+ */
+#define OV_ECTL_LOWLATENCY_SET       0x71
+
+/**
+ *  Returns the encoder's algorithmic latency in samples in the long
+ *  pointed to by arg.
+ *
+ * Argument: <tt>long *</tt>
+ *
+ *  This is the most input vorbis_analysis_blockout() may hold beyond
+ *  the last sample a decoder can fully reconstruct from the packets
+ *  produced so far.  Encoding through vorbis_analysis_packetout() with
+ *  several threads may hold a few more blocks.  Only valid after
+ *  vorbis_encode_setup_init().
+ */
+#define OV_ECTL_LATENCY_GET          0x80
+
   /* deprecated rate management supported only for compatibility */
 
 /**
@@ -25,10 +25,9 @@
 #include "os.h"
 #include "misc.h"
 
-/* decides between modes, dispatches to the appropriate mapping. */
-int vorbis_analysis(vorbis_block *vb, ogg_packet *op){
-  int ret,i;
+static void analysis_begin(vorbis_block *vb){
   vorbis_block_internal *vbi=vb->internal;
+  int i;
 
   vb->glue_bits=0;
   vb->time_bits=0;
@@ -38,6 +37,14 @@ int vorbis_analysis(vorbis_block *vb, ogg_packet *op){
   /* first things first.  Make sure encode is ready */
   for(i=0;i<PACKETBLOBS;i++)
     oggpack_reset(vbi->packetblob[i]);
+  vbi->mapstate=NULL;
+}
+
+/* decides between modes, dispatches to the appropriate mapping. */
+int vorbis_analysis(vorbis_block *vb, ogg_packet *op){
+  int ret;
+
+  analysis_begin(vb);
 
   /* we only have one mapping type (0), and we let the mapping code
      itself figure out what soft mode to use.  This allows easier
@@ -62,6 +69,73 @@ int vorbis_analysis(vorbis_block *vb, ogg_packet *op){
   return(0);
 }
 
+static void analysis_encode_job(void *arg,int i){
+  private_state *b=((vorbis_dsp_state *)arg)->backend_state;
+  b->pipe_ret[i]=_mapping_P[0]->encode(b->pipe+i);
+}
+
+/* blockout, analysis and bitrate management in one call, working on
+   a batch of blocks at a time when the encoder has worker threads.
+   Block boundaries and peak tracking are decided in order on the
+   calling thread; the bulk of each block's analysis then runs
+   concurrently, and bitrate management takes the blocks back in
+   order.  The packets are those the separate calls would produce. */
+int vorbis_analysis_packetout(vorbis_dsp_state *v,ogg_packet *op){
+  private_state *b=v->backend_state;
+  int ret,i;
+
+  if(!b || !b->ve || !op)return(OV_EINVAL);
+
+  if(!b->pipe){
+    int threads=_vorbis_pool_threads(b->pool);
+    b->pipe_size=(threads>1?threads*2:1);
+    b->pipe=_ogg_calloc(b->pipe_size,sizeof(*b->pipe));
+    b->pipe_ret=_ogg_calloc(b->pipe_size,sizeof(*b->pipe_ret));
+    if(!b->pipe || !b->pipe_ret)return(OV_EFAULT);
+    for(i=0;i<b->pipe_size;i++)
+      vorbis_block_init(v,b->pipe+i);
+    b->pipe_ampmax=((vorbis_block_internal *)b->pipe[0].internal)->ampmax;
+  }
+
+  if(b->pipe_ready && b->pipe_next==b->pipe_ready)
+    b->pipe_fill=b->pipe_ready=b->pipe_next=0;
+
+  if(!b->pipe_ready){
+    while(b->pipe_fill<b->pipe_size){
+      vorbis_block *vb=b->pipe+b->pipe_fill;
+      vorbis_block_internal *vbi=vb->internal;
+
+      /* blockout folds the previous block's peak into the global
+         tracking; hand it over as if one block were being reused */
+      vbi->ampmax=b->pipe_ampmax;
+      if(vorbis_analysis_blockout(v,vb)!=1)break;
+
+      analysis_begin(vb);
+      if((ret=_mapping_P[0]->transform(vb)))
+        return(ret);
+      b->pipe_ampmax=vbi->ampmax;
+      b->pipe_fill++;
+      if(vb->eofflag)break;
+    }
+
+    /* wait for a full batch unless the stream has ended */
+    if(!b->pipe_fill)return(0);
+    if(b->pipe_fill<b->pipe_size && !b->pipe[b->pipe_fill-1].eofflag)
+      return(0);
+
+    b->pipelined=1;
+    _vorbis_pool_run(b->pool,analysis_encode_job,v,b->pipe_fill);
+    b->pipelined=0;
+    b->pipe_ready=b->pipe_fill;
+  }
+
+  i=b->pipe_next++;
+  if(b->pipe_ret[i])return(b->pipe_ret[i]);
+  if((ret=vorbis_bitrate_addblock(b->pipe+i)))return(ret);
+  vorbis_bitrate_flushpacket(v,op);
+  return(1);
+}
+
 #ifdef ANALYSIS
 int analysis_noisy=1;
 
@@ -125,6 +125,11 @@ typedef struct{
   void (*free_info)    (vorbis_info_mapping *);
   int  (*forward)      (struct vorbis_block *vb);
   int  (*inverse)      (struct vorbis_block *vb,vorbis_info_mapping *);
+  /* forward split in two: transform must run in block order, encode
+     may run concurrently for different blocks */
+  int  (*transform)    (struct vorbis_block *vb);
+  int  (*encode)       (struct vorbis_block *vb);
+  int  (*blob)         (struct vorbis_block *vb,int blobno);
 } vorbis_func_mapping;
 
 typedef struct vorbis_info_mapping0{
@@ -20,6 +20,7 @@
 #include <ogg/ogg.h>
 #include "vorbis/codec.h"
 #include "codec_internal.h"
+#include "registry.h"
 #include "os.h"
 #include "misc.h"
 #include "bitrate.h"
@@ -69,6 +70,27 @@ int vorbis_bitrate_managed(vorbis_block *vb){
   return(0);
 }
 
+/* the packetblob the floater currently points at; addblock starts
+   its search here */
+int vorbis_bitrate_guess(vorbis_block *vb){
+  private_state         *b=vb->vd->backend_state;
+  bitrate_manager_state *bm=&b->bms;
+  int                    choice=rint(bm->avgfloat);
+
+  if(choice<0)choice=0;
+  if(choice>=PACKETBLOBS)choice=PACKETBLOBS-1;
+  return(choice);
+}
+
+/* size of a candidate packetblob, encoding it first if the mapping
+   left it for later */
+static long blob_bits(vorbis_block *vb,int choice){
+  vorbis_block_internal *vbi=vb->internal;
+  if(!vbi->blobready[choice])
+    _mapping_P[0]->blob(vb,choice);
+  return(oggpack_bytes(vbi->packetblob[choice])*8);
+}
+
 /* finish taking in the block we just processed */
 int vorbis_bitrate_addblock(vorbis_block *vb){
   vorbis_block_internal *vbi=vb->internal;
@@ -80,7 +102,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
   bitrate_manager_info  *bi=&ci->bi;
 
   int  choice=rint(bm->avgfloat);
-  long this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+  long this_bits;
   long min_target_bits=(vb->W?bm->min_bitsper*bm->short_per_long:bm->min_bitsper);
   long max_target_bits=(vb->W?bm->max_bitsper*bm->short_per_long:bm->max_bitsper);
   int  samples=ci->blocksizes[vb->W]>>1;
@@ -96,6 +118,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
   }
 
   bm->vb=vb;
+  this_bits=blob_bits(vb,choice);
 
   /* look ahead for avg floater */
   if(bm->avg_bitsper>0){
@@ -118,13 +141,13 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(choice>0 && this_bits>avg_target_bits &&
             bm->avg_reservoir+(this_bits-avg_target_bits)>desired_fill){
         choice--;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }else if(bm->avg_reservoir+(this_bits-avg_target_bits)<desired_fill){
       while(choice+1<PACKETBLOBS && this_bits<avg_target_bits &&
             bm->avg_reservoir+(this_bits-avg_target_bits)<desired_fill){
         choice++;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
 
@@ -132,7 +155,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     if(slew<-slewlimit)slew=-slewlimit;
     if(slew>slewlimit)slew=slewlimit;
     choice=rint(bm->avgfloat+= slew/vi->rate*samples);
-    this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+    this_bits=blob_bits(vb,choice);
   }
 
 
@@ -144,7 +167,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(bm->minmax_reservoir-(min_target_bits-this_bits)<0){
         choice++;
         if(choice>=PACKETBLOBS)break;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
   }
@@ -156,7 +179,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(bm->minmax_reservoir+(this_bits-max_target_bits)>bi->reservoir_bits){
         choice--;
         if(choice<0)break;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
   }
@@ -173,7 +196,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     if(oggpack_bytes(vbi->packetblob[choice])>maxsize){
 
       oggpack_writetrunc(vbi->packetblob[choice],maxsize*8);
-      this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+      this_bits=blob_bits(vb,choice);
     }
   }else{
     long minsize=(min_target_bits-bm->minmax_reservoir+7)/8;
@@ -185,7 +208,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     /* prop up bitrate according to demand. pad this frame out with zeroes */
     minsize-=oggpack_bytes(vbi->packetblob[choice]);
     while(minsize-->0)oggpack_write(vbi->packetblob[choice],0,8);
-    this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+    this_bits=blob_bits(vb,choice);
 
   }
 
@@ -23,10 +23,12 @@
 #include <ogg/ogg.h>
 #include "vorbis/codec.h"
 #include "codec_internal.h"
+#include "backends.h"
 
 #include "window.h"
 #include "mdct.h"
 #include "lpc.h"
+#include "cache.h"
 #include "registry.h"
 #include "misc.h"
 
@@ -157,6 +159,11 @@ int vorbis_block_clear(vorbis_block *vb){
       oggpack_writeclear(vbi->packetblob[i]);
       if(i!=PACKETBLOBS/2)_ogg_free(vbi->packetblob[i]);
     }
+    if(vbi->chanblock){
+      for(i=0;i<vbi->chanblocks;i++)
+        vorbis_block_clear(vbi->chanblock+i);
+      _ogg_free(vbi->chanblock);
+    }
     _ogg_free(vbi);
   }
   memset(vb,0,sizeof(*vb));
@@ -167,6 +174,30 @@ int vorbis_block_clear(vorbis_block *vb){
    here and not in analysis.c (which is for analysis transforms only).
    The init is here because some of it is shared */
 
+/* the transform lookups depend only on the block size; every stream
+   using a size shares one read-only copy */
+static void *_mdct_build(void *n){
+  mdct_lookup *l=_ogg_calloc(1,sizeof(*l));
+  if(l)mdct_init(l,*(int *)n);
+  return l;
+}
+
+static void _mdct_destroy(void *l){
+  mdct_clear(l);
+  _ogg_free(l);
+}
+
+static void *_drft_build(void *n){
+  drft_lookup *l=_ogg_calloc(1,sizeof(*l));
+  if(l)drft_init(l,*(int *)n);
+  return l;
+}
+
+static void _drft_destroy(void *l){
+  drft_clear(l);
+  _ogg_free(l);
+}
+
 static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
   int i;
   codec_setup_info *ci=vi->codec_setup;
@@ -192,10 +223,11 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
 
   /* MDCT is tranform 0 */
 
-  b->transform[0][0]=_ogg_calloc(1,sizeof(mdct_lookup));
-  b->transform[1][0]=_ogg_calloc(1,sizeof(mdct_lookup));
-  mdct_init(b->transform[0][0],ci->blocksizes[0]>>hs);
-  mdct_init(b->transform[1][0],ci->blocksizes[1]>>hs);
+  for(i=0;i<2;i++){
+    int n=ci->blocksizes[i]>>hs;
+    b->transform[i][0]=_vorbis_cache_get(VC_MDCT,&n,sizeof(n),
+                                         _mdct_build,&n,_mdct_destroy);
+  }
 
   /* Vorbis I uses only window type 0 */
   /* note that the correct computation below is technically:
@@ -209,9 +241,14 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
 
   if(encp){ /* encode/decode differ here */
 
-    /* analysis always needs an fft */
-    drft_init(&b->fft_look[0],ci->blocksizes[0]);
-    drft_init(&b->fft_look[1],ci->blocksizes[1]);
+    /* analysis always needs an fft.  The shared lookups can't lend
+       their own scratch space, so each stream brings its own */
+    for(i=0;i<2;i++){
+      int n=ci->blocksizes[i];
+      b->fft_look[i]=_vorbis_cache_get(VC_DRFT,&n,sizeof(n),
+                                       _drft_build,&n,_drft_destroy);
+    }
+    b->fft_work=_ogg_malloc(ci->blocksizes[1]*sizeof(*b->fft_work));
 
     /* finish the codebooks */
     if(!ci->fullbooks){
@@ -231,17 +268,18 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
 
     v->analysisp=1;
   }else{
-    /* finish the codebooks */
+    /* finish the codebooks.  Only validate them here; the decode
+       tables are built by _vds_build_books when a packet first uses a
+       mode that needs them.  The lock is held through the backend
+       lookups below, which read the books' shape. */
+    _vorbis_mutex_lock(&ci->book_lock);
     if(!ci->fullbooks){
       ci->fullbooks=_ogg_calloc(ci->books,sizeof(*ci->fullbooks));
       for(i=0;i<ci->books;i++){
         if(ci->book_param[i]==NULL)
           goto abort_books;
-        if(vorbis_book_init_decode(ci->fullbooks+i,ci->book_param[i]))
+        if(vorbis_book_check_decode(ci->fullbooks+i,ci->book_param[i]))
           goto abort_books;
-        /* decode codebooks are now standalone after init */
-        vorbis_staticbook_destroy(ci->book_param[i]);
-        ci->book_param[i]=NULL;
       }
     }
   }
@@ -279,6 +317,8 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
     b->residue[i]=_residue_P[ci->residue_type[i]]->
       look(v,ci->residue_param[i]);
 
+  if(!encp)_vorbis_mutex_unlock(&ci->book_lock);
+
   return 0;
  abort_books:
   for(i=0;i<ci->books;i++){
@@ -287,16 +327,78 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
       ci->book_param[i]=NULL;
     }
   }
+  _vorbis_mutex_unlock(&ci->book_lock);
   vorbis_dsp_clear(v);
   return -1;
 }
 
+static int _vds_build_book(codec_setup_info *ci,int book){
+  if(book<0 || book>=ci->books)return 0;
+  if(ci->book_param[book]){
+    if(vorbis_book_init_decode(ci->fullbooks+book,ci->book_param[book]))
+      return -1;
+    ci->books_built++;
+    /* decode codebooks are standalone once built */
+    vorbis_staticbook_destroy(ci->book_param[book]);
+    ci->book_param[book]=NULL;
+  }
+  return 0;
+}
+
+/* build the decode tables of every book referenced by the floors and
+   residues of a mode's mapping.  Books used only by modes that never
+   appear in the stream are never built. */
+int _vds_build_books(vorbis_dsp_state *v,int mode){
+  vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  private_state *b=v->backend_state;
+  vorbis_info_mapping0 *map=ci->map_param[ci->mode_param[mode]->mapping];
+  int i,j,k,ret=0;
+
+  _vorbis_mutex_lock(&ci->book_lock);
+  for(i=0;i<map->submaps && !ret;i++){
+    int floor=map->floorsubmap[i];
+    int residue=map->residuesubmap[i];
+
+    if(ci->floor_type[floor]==0){
+      vorbis_info_floor0 *info=ci->floor_param[floor];
+      for(j=0;j<info->numbooks;j++)
+        ret|=_vds_build_book(ci,info->books[j]);
+    }else{
+      vorbis_info_floor1 *info=ci->floor_param[floor];
+      for(j=0;j<info->partitions;j++){
+        int class=info->partitionclass[j];
+        if(info->class_subs[class])
+          ret|=_vds_build_book(ci,info->class_book[class]);
+        for(k=0;k<(1<<info->class_subs[class]);k++)
+          ret|=_vds_build_book(ci,info->class_subbook[class][k]);
+      }
+    }
+
+    {
+      vorbis_info_residue0 *info=ci->residue_param[residue];
+      int acc=0;
+      ret|=_vds_build_book(ci,info->groupbook);
+      for(j=0;j<info->partitions;j++)
+        for(k=info->secondstages[j];k;k>>=1)
+          if(k&1)
+            ret|=_vds_build_book(ci,info->booklist[acc++]);
+    }
+  }
+  _vorbis_mutex_unlock(&ci->book_lock);
+
+  if(!ret)b->books_ready[mode]=1;
+  return ret;
+}
+
 /* arbitrary settings and spec-mandated numbers get filled in here */
 int vorbis_analysis_init(vorbis_dsp_state *v,vorbis_info *vi){
   private_state *b=NULL;
+  codec_setup_info *ci;
 
   if(_vds_shared_init(v,vi,1))return 1;
   b=v->backend_state;
+  ci=vi->codec_setup;
   b->psy_g_look=_vp_global_look(vi);
 
   /* Initialize the envelope state storage */
@@ -305,6 +407,17 @@ int vorbis_analysis_init(vorbis_dsp_state *v,vorbis_info *vi){
 
   vorbis_bitrate_init(vi,&b->bms);
 
+  /* the calling thread, the envelope search and the pool's workers
+     together stay within the requested thread count */
+  b->pool=_vorbis_pool_create(ci->hi.threads-b->ve->threaded);
+  if(b->pool){
+    b->blobblock=_ogg_calloc(PACKETBLOBS,sizeof(*b->blobblock));
+    if(!b->blobblock){
+      _vorbis_pool_destroy(b->pool);
+      b->pool=NULL;
+    }
+  }
+
   /* compressed audio packets start after the headers
      with sequence number 3 */
   v->sequence=3;
@@ -326,16 +439,11 @@ void vorbis_dsp_clear(vorbis_dsp_state *v){
         _ogg_free(b->ve);
       }
 
-      if(b->transform[0]){
-        mdct_clear(b->transform[0][0]);
-        _ogg_free(b->transform[0][0]);
-        _ogg_free(b->transform[0]);
-      }
-      if(b->transform[1]){
-        mdct_clear(b->transform[1][0]);
-        _ogg_free(b->transform[1][0]);
-        _ogg_free(b->transform[1]);
-      }
+      for(i=0;i<2;i++)
+        if(b->transform[i]){
+          _vorbis_cache_release(b->transform[i][0]);
+          _ogg_free(b->transform[i]);
+        }
 
       if(b->flr){
         if(ci)
@@ -361,15 +469,30 @@ void vorbis_dsp_clear(vorbis_dsp_state *v){
       if(b->psy_g_look)_vp_global_free(b->psy_g_look);
       vorbis_bitrate_clear(&b->bms);
 
-      drft_clear(&b->fft_look[0]);
-      drft_clear(&b->fft_look[1]);
+      if(b->pipe){
+        for(i=0;i<b->pipe_size;i++)
+          vorbis_block_clear(b->pipe+i);
+        _ogg_free(b->pipe);
+      }
+      if(b->pipe_ret)_ogg_free(b->pipe_ret);
+
+      _vorbis_pool_destroy(b->pool);
+      if(b->blobblock){
+        for(i=0;i<PACKETBLOBS;i++)
+          vorbis_block_clear(b->blobblock+i);
+        _ogg_free(b->blobblock);
+      }
+
+      _vorbis_cache_release(b->fft_look[0]);
+      _vorbis_cache_release(b->fft_look[1]);
+      if(b->fft_work)_ogg_free(b->fft_work);
 
     }
 
     if(v->pcm){
       if(vi)
         for(i=0;i<vi->channels;i++)
-          if(v->pcm[i])_ogg_free(v->pcm[i]);
+          if(v->pcm[i])_ogg_free(v->pcm[i]-(b?b->pcm_offset:0));
       _ogg_free(v->pcm);
       if(v->pcmret)_ogg_free(v->pcmret);
     }
@@ -389,8 +512,12 @@ void vorbis_dsp_clear(vorbis_dsp_state *v){
 float **vorbis_analysis_buffer(vorbis_dsp_state *v, int vals){
   int i;
   vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
   private_state *b=v->backend_state;
 
+  /* the storage may move; let a background envelope scan finish */
+  _ve_envelope_sync(b->ve);
+
   /* free header, header1, header2 */
   if(b->header)_ogg_free(b->header);b->header=NULL;
   if(b->header1)_ogg_free(b->header1);b->header1=NULL;
@@ -399,11 +526,27 @@ float **vorbis_analysis_buffer(vorbis_dsp_state *v, int vals){
   /* Do we have enough storage space for the requested buffer? If not,
      expand the PCM (and envelope) storage */
 
-  if(v->pcm_current+vals>=v->pcm_storage){
-    v->pcm_storage=v->pcm_current+vals*2;
+  if(v->pcm_current+vals>=v->pcm_storage-b->pcm_offset){
 
-    for(i=0;i<vi->channels;i++){
-      v->pcm[i]=_ogg_realloc(v->pcm[i],v->pcm_storage*sizeof(*v->pcm[i]));
+    /* blockout retires samples by advancing the channel vectors
+       rather than moving what is left; slide the live samples back
+       to the start of storage only once that space is needed */
+    if(b->pcm_offset){
+      for(i=0;i<vi->channels;i++){
+        float *base=v->pcm[i]-b->pcm_offset;
+        memmove(base,v->pcm[i],v->pcm_current*sizeof(*v->pcm[i]));
+        v->pcm[i]=base;
+      }
+      b->pcm_offset=0;
+    }
+
+    if(v->pcm_current+vals>=v->pcm_storage){
+      /* leave room to retire a few long blocks between slides */
+      v->pcm_storage=v->pcm_current+vals*2+ci->blocksizes[1]*4;
+
+      for(i=0;i<vi->channels;i++){
+        v->pcm[i]=_ogg_realloc(v->pcm[i],v->pcm_storage*sizeof(*v->pcm[i]));
+      }
     }
   }
 
@@ -460,6 +603,9 @@ static void _preextrapolate_helper(vorbis_dsp_state *v){
 int vorbis_analysis_wrote(vorbis_dsp_state *v, int vals){
   vorbis_info *vi=v->vi;
   codec_setup_info *ci=vi->codec_setup;
+  private_state *b=v->backend_state;
+
+  _ve_envelope_sync(b->ve);
 
   if(vals<=0){
     int order=32;
@@ -504,21 +650,94 @@ int vorbis_analysis_wrote(vorbis_dsp_state *v, int vals){
     }
   }else{
 
-    if(v->pcm_current+vals>v->pcm_storage)
+    if(v->pcm_current+vals>v->pcm_storage-b->pcm_offset)
       return(OV_EINVAL);
 
     v->pcm_current+=vals;
 
     /* we may want to reverse extrapolate the beginning of a stream
        too... in case we're beginning on a cliff! */
-    /* clumsy, but simple.  It only runs once, so simple is good. */
-    if(!v->preextrapolate && v->pcm_current-v->centerW>ci->blocksizes[1])
-      _preextrapolate_helper(v);
+    /* clumsy, but simple.  It only runs once, so simple is good.
+       Short-block-only encoding settles for a shorter predictor
+       history rather than wait on a long block of input. */
+    if(!v->preextrapolate){
+      long need=ci->blocksizes[ci->psy_g_param.fixed_blocksize==1?0:1];
+      if(v->pcm_current-v->centerW>need)
+        _preextrapolate_helper(v);
+    }
 
   }
+
+  /* blockout only searches extrapolated input; with worker threads
+     the search gets going now rather than when blockout asks */
+  if(v->preextrapolate)_ve_envelope_post(v);
   return(0);
 }
 
+/* interleaved input, converted and split straight into the analysis
+   buffers.  vals counts samples per channel; vals<=0 marks the end of
+   input exactly as vorbis_analysis_wrote() does */
+int vorbis_analysis_write_interleaved_s16(vorbis_dsp_state *v,
+                                          const short *pcm,int vals){
+  int i,j,ch;
+  float **buf;
+
+  if(vals<=0)return(vorbis_analysis_wrote(v,vals));
+  if(!pcm)return(OV_EINVAL);
+
+  ch=v->vi->channels;
+  buf=vorbis_analysis_buffer(v,vals);
+  for(j=0;j<ch;j++){
+    const short *in=pcm+j;
+    float *out=buf[j];
+    for(i=0;i<vals;i++)
+      out[i]=in[i*ch]*(1.f/32768.f);
+  }
+  return(vorbis_analysis_wrote(v,vals));
+}
+
+/* packed little endian 24 bit samples, three bytes each */
+int vorbis_analysis_write_interleaved_s24(vorbis_dsp_state *v,
+                                          const unsigned char *pcm,int vals){
+  int i,j,ch;
+  float **buf;
+
+  if(vals<=0)return(vorbis_analysis_wrote(v,vals));
+  if(!pcm)return(OV_EINVAL);
+
+  ch=v->vi->channels;
+  buf=vorbis_analysis_buffer(v,vals);
+  for(j=0;j<ch;j++){
+    const unsigned char *in=pcm+j*3;
+    float *out=buf[j];
+    for(i=0;i<vals;i++,in+=ch*3){
+      long s=in[0]|(in[1]<<8)|((long)in[2]<<16);
+      if(s&0x800000L)s-=0x1000000L;
+      out[i]=s*(1.f/8388608.f);
+    }
+  }
+  return(vorbis_analysis_wrote(v,vals));
+}
+
+int vorbis_analysis_write_interleaved_f32(vorbis_dsp_state *v,
+                                          const float *pcm,int vals){
+  int i,j,ch;
+  float **buf;
+
+  if(vals<=0)return(vorbis_analysis_wrote(v,vals));
+  if(!pcm)return(OV_EINVAL);
+
+  ch=v->vi->channels;
+  buf=vorbis_analysis_buffer(v,vals);
+  for(j=0;j<ch;j++){
+    const float *in=pcm+j;
+    float *out=buf[j];
+    for(i=0;i<vals;i++)
+      out[i]=in[i*ch];
+  }
+  return(vorbis_analysis_wrote(v,vals));
+}
+
 /* do the deltas, envelope shaping, pre-echo and determine the size of
    the next block on which to continue analysis */
 int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
@@ -542,8 +761,12 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
 
   /* we do an envelope search even on a single blocksize; we may still
      be throwing more bits at impulses, and envelope search handles
-     marking impulses too. */
-  {
+     marking impulses too.  The speed and low latency settings skip
+     it and always pick the same block size. */
+  if(ci->psy_g_param.fixed_blocksize)
+    v->nW=(ci->psy_g_param.fixed_blocksize==2 &&
+           ci->blocksizes[0]!=ci->blocksizes[1]);
+  else{
     long bp=_ve_envelope_search(v);
     if(bp==-1){
 
@@ -593,7 +816,7 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
       /*fprintf(stderr,"_");*/
     }
   }else{
-    if(_ve_envelope_mark(v)){
+    if(!ci->psy_g_param.fixed_blocksize && _ve_envelope_mark(v)){
       vbi->blocktype=BLOCKTYPE_IMPULSE;
       /*fprintf(stderr,"|");*/
 
@@ -651,12 +874,13 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
 
     if(movementW>0){
 
-      _ve_envelope_shift(b->ve,movementW);
+      if(!ci->psy_g_param.fixed_blocksize)
+        _ve_envelope_shift(b->ve,movementW);
       v->pcm_current-=movementW;
 
       for(i=0;i<vi->channels;i++)
-        memmove(v->pcm[i],v->pcm[i]+movementW,
-                v->pcm_current*sizeof(*v->pcm[i]));
+        v->pcm[i]+=movementW;
+      b->pcm_offset+=movementW;
 
 
       v->lW=v->W;
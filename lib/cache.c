@@ -0,0 +1,150 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: process wide cache of read-only lookups
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ogg/ogg.h>
+#include "vorbis/codec.h"
+#include "thread.h"
+#include "cache.h"
+
+typedef struct cache_entry {
+  struct cache_entry *next;
+  int    kind;
+  long   keylen;
+  void  *key;
+  void  *data;
+  long   refs;
+  void (*destroy)(void *data);
+} cache_entry;
+
+/* a few dozen lookups per encoder configuration; a list will do.
+   Entries nobody references are kept, most recently used first, so
+   that encoders created one after another don't rebuild everything;
+   past VC_IDLE_MAX of those the least recently used are freed.  That
+   is about one stereo configuration's worth; vorbis_cache_clear()
+   frees the rest. */
+#define VC_IDLE_MAX 64
+
+static vorbis_mutex  cache_lock=VORBIS_MUTEX_INITIALIZER;
+static cache_entry  *cache_list=NULL;
+
+static void cache_free(cache_entry *e){
+  while(e){
+    cache_entry *next=e->next;
+    e->destroy(e->data);
+    _ogg_free(e->key);
+    _ogg_free(e);
+    e=next;
+  }
+}
+
+/* unlinks the idle entries past the first keep of them; call with
+   cache_lock held */
+static cache_entry *cache_unlink_idle(long keep){
+  cache_entry **p=&cache_list;
+  cache_entry *evict=NULL;
+  long idle=0;
+
+  while(*p){
+    if((*p)->refs==0 && ++idle>keep){
+      cache_entry *x=*p;
+      *p=x->next;
+      x->next=evict;
+      evict=x;
+    }else
+      p=&(*p)->next;
+  }
+  return evict;
+}
+
+void *_vorbis_cache_get(int kind,const void *key,long keylen,
+                        void *(*build)(void *arg),void *arg,
+                        void (*destroy)(void *data)){
+  cache_entry *e;
+  void *data=NULL;
+
+  _vorbis_mutex_lock(&cache_lock);
+  for(e=cache_list;e;e=e->next)
+    if(e->kind==kind && e->keylen==keylen && !memcmp(e->key,key,keylen))
+      break;
+
+  if(e){
+    e->refs++;
+    data=e->data;
+  }else{
+    /* built under the lock so that racing first users don't each
+       build a copy; setup is rare next to encoding */
+    e=_ogg_calloc(1,sizeof(*e));
+    if(e){
+      e->key=_ogg_malloc(keylen);
+      if(e->key)e->data=build(arg);
+      if(e->data){
+        memcpy(e->key,key,keylen);
+        e->kind=kind;
+        e->keylen=keylen;
+        e->refs=1;
+        e->destroy=destroy;
+        e->next=cache_list;
+        cache_list=e;
+        data=e->data;
+      }else{
+        if(e->key)_ogg_free(e->key);
+        _ogg_free(e);
+      }
+    }
+  }
+  _vorbis_mutex_unlock(&cache_lock);
+
+  return data;
+}
+
+void _vorbis_cache_release(void *data){
+  cache_entry **p;
+  cache_entry *e=NULL;
+  cache_entry *evict=NULL;
+
+  if(!data)return;
+
+  _vorbis_mutex_lock(&cache_lock);
+  for(p=&cache_list;*p;p=&(*p)->next)
+    if((*p)->data==data){
+      e=*p;
+      if(--e->refs==0){
+        /* move to the front as the most recently idle */
+        *p=e->next;
+        e->next=cache_list;
+        cache_list=e;
+      }
+      break;
+    }
+
+  if(e && e->refs==0)
+    evict=cache_unlink_idle(VC_IDLE_MAX);
+  _vorbis_mutex_unlock(&cache_lock);
+
+  cache_free(evict);
+}
+
+void vorbis_cache_clear(void){
+  cache_entry *evict;
+
+  _vorbis_mutex_lock(&cache_lock);
+  evict=cache_unlink_idle(0);
+  _vorbis_mutex_unlock(&cache_lock);
+
+  cache_free(evict);
+}
@@ -0,0 +1,44 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: process wide cache of read-only lookups
+
+ ********************************************************************/
+
+#ifndef _V_CACHE_H_
+#define _V_CACHE_H_
+
+/* Lookups that depend only on their settings (transform tables,
+   codebook encode tables, psychoacoustic curves, packed setup headers)
+   are built once per distinct key and shared by every vorbis_dsp_state
+   that asks for them.  Entries are reference counted; a bounded number
+   of unused ones are kept for the next encoder with the same settings
+   until vorbis_cache_clear() frees them.  Shared data must not be
+   written after it is built. */
+
+#define VC_MDCT   0
+#define VC_DRFT   1
+#define VC_BOOK   2
+#define VC_PSY    3
+#define VC_HEADER 4
+
+/* returns the entry of the given kind whose key matches key[0..keylen)
+   byte for byte, calling build(arg) to make it on a miss.  The key is
+   only compared; whatever the build needs comes through arg.  NULL if
+   the build fails. */
+extern void *_vorbis_cache_get(int kind,const void *key,long keylen,
+                               void *(*build)(void *arg),void *arg,
+                               void (*destroy)(void *data));
+/* drops a reference taken by _vorbis_cache_get */
+extern void  _vorbis_cache_release(void *data);
+
+#endif
@@ -276,6 +276,32 @@ int vorbis_book_encode(codebook *book, int a, oggpack_buffer *b){
   return(book->c->lengthlist[a]);
 }
 
+void vorbis_writer_init(codeword_writer *w,oggpack_buffer *b){
+  w->opb=b;
+  w->word=0;
+  w->bits=0;
+}
+
+void vorbis_writer_flush(codeword_writer *w){
+  if(w->bits)oggpack_write(w->opb,w->word,w->bits);
+  w->word=0;
+  w->bits=0;
+}
+
+/* same bits as vorbis_book_encode(), written through w */
+int vorbis_book_encodew(codebook *book, int a, codeword_writer *w){
+  int len;
+  if(a<0 || a>=book->c->entries)return(0);
+  len=book->c->lengthlist[a];
+  if(w->bits+len>32)vorbis_writer_flush(w);
+  if(len>0){
+    /* bits<32 here, so the shift is defined */
+    w->word|=book->codelist[a]<<w->bits;
+    w->bits+=len;
+  }
+  return(len);
+}
+
 /* the 'eliminate the decode tree' optimization actually requires the
    codewords to be MSb first, not LSb.  This is an annoying inelegancy
    (and one of the first places where carefully thought out design
@@ -345,6 +371,86 @@ STIN long decode_packed_entry_number(codebook *book, oggpack_buffer *b){
   return(-1);
 }
 
+/* Lattice books (and most others in practice) are a small integer
+   times delta plus an offset.  Decode can keep just the integers, a
+   quarter or half the size of the float vectors, which keeps the big
+   residue books from crowding the rest of the working set out of
+   cache.  The reconstruction below is the one used at decode time, so
+   a book is only compacted if it reproduces every value bit for bit. */
+
+STIN float compact_value(const codebook *book,long i){
+  if(book->dec_qbytes==1)
+    return book->dec_qmin+book->dec_qdelta*((signed char *)book->dec_qlist)[i];
+  return book->dec_qmin+book->dec_qdelta*((ogg_int16_t *)book->dec_qlist)[i];
+}
+
+/* returns the value vector of a packed entry.  Compacted books are
+   expanded into scratch, which holds VQ_COMPACT_MAXDIM floats */
+STIN const float *entry_values(const codebook *book,long entry,
+                               float *scratch,const int dim){
+  int j;
+  if(!book->dec_qlist)return book->valuelist+entry*dim;
+  for(j=0;j<dim;j++)
+    scratch[j]=compact_value(book,entry*dim+j);
+  return scratch;
+}
+
+/* returns 1 if valuelist was replaced by a compact list, 0 if not */
+int vorbis_book_compact_values(codebook *book){
+  long i,n=book->used_entries*book->dim;
+  float min,max,delta;
+  int bytes;
+  long lim;
+
+  if(!book->valuelist || book->dim>VQ_COMPACT_MAXDIM || n<=0)return(0);
+
+  /* the spacing of the lattice is the smallest nonzero difference from
+     the minimum; a book that isn't a lattice fails the check below */
+  min=max=book->valuelist[0];
+  for(i=1;i<n;i++){
+    if(book->valuelist[i]<min)min=book->valuelist[i];
+    if(book->valuelist[i]>max)max=book->valuelist[i];
+  }
+  delta=max-min;
+  for(i=0;i<n;i++){
+    float d=book->valuelist[i]-min;
+    if(d>0.f && d<delta)delta=d;
+  }
+  if(delta<=0.f)delta=1.f;
+  if(!(max-min<=delta*65535.f))return(0);
+
+  /* center the integers on zero so they fit a signed type */
+  lim=(long)rint((max-min)/delta);
+  bytes=(lim<256 ? 1 : 2);
+  book->dec_qmin=min+delta*(float)((lim+1)/2);
+  book->dec_qdelta=delta;
+  book->dec_qbytes=bytes;
+  book->dec_qlist=_ogg_malloc(n*bytes);
+
+  for(i=0;i<n;i++){
+    long k=(long)rint((book->valuelist[i]-book->dec_qmin)/delta);
+    float check;
+    if(k<(bytes==1?-128:-32768) || k>(bytes==1?127:32767))break;
+    if(bytes==1)
+      ((signed char *)book->dec_qlist)[i]=k;
+    else
+      ((ogg_int16_t *)book->dec_qlist)[i]=k;
+    check=compact_value(book,i);
+    if(memcmp(&check,book->valuelist+i,sizeof(check)))break;
+  }
+
+  if(i<n){
+    _ogg_free(book->dec_qlist);
+    book->dec_qlist=NULL;
+    book->dec_qbytes=0;
+    return(0);
+  }
+
+  _ogg_free(book->valuelist);
+  book->valuelist=NULL;
+  return(1);
+}
+
 /* Decode side is specced and easier, because we don't need to find
    matches using different criteria; we simply read and map.  There are
    two things we need to do 'depending':
@@ -371,23 +477,145 @@ long vorbis_book_decode(codebook *book, oggpack_buffer *b){
   return(-1);
 }
 
+/* The residue books in use are only ever of dimension 1, 2, 4 or 8;
+   the kernels below are written against a dimension that is constant
+   once inlined so that the compiler can unroll (and vectorize) the
+   per-entry add.  vorbis_book_select_kernels picks one per book when
+   its decode tables are built; other dimensions, and partitions that
+   aren't a whole number of entries, take the generic loops. */
+
+#define DECODEVS_STACK 64
+
+STIN long decodevs_add_dim(codebook *book,float *a,oggpack_buffer *b,
+                           int n,const int dim){
+  int step=n/dim;
+  int stack[DECODEVS_STACK];
+  int *entry=(step>DECODEVS_STACK ? alloca(sizeof(*entry)*step) : stack);
+  int i,j;
+
+  /* decode the whole partition before touching the vector so that a
+     truncated packet leaves it as it was */
+  for (j = 0; j < step; j++) {
+    entry[j]=decode_packed_entry_number(book,b);
+    if(entry[j]==-1)return(-1);
+  }
+  for (j = 0; j < step; j++) {
+    float scratch[VQ_COMPACT_MAXDIM];
+    const float *t=entry_values(book,entry[j],scratch,dim);
+    for(i=0;i<dim;i++)
+      a[i*step+j]+=t[i];
+  }
+  return(0);
+}
+
+STIN long decodev_add_dim(codebook *book,float *a,oggpack_buffer *b,
+                          int n,const int dim){
+  int i,j;
+  for(i=0;i<n;i+=dim){
+    long entry=decode_packed_entry_number(book,b);
+    float scratch[VQ_COMPACT_MAXDIM];
+    const float *t;
+    if(entry==-1)return(-1);
+    t=entry_values(book,entry,scratch,dim);
+    for(j=0;j<dim;j++)
+      a[i+j]+=t[j];
+  }
+  return(0);
+}
+
+/* the generic loops take any dimension and ragged partitions */
+static long decodevs_add_any(codebook *book,float *a,oggpack_buffer *b,int n){
+  int step=n/book->dim;
+  long *entry = alloca(sizeof(*entry)*step);
+  int i,j,o;
+
+  for (i = 0; i < step; i++) {
+    entry[i]=decode_packed_entry_number(book,b);
+    if(entry[i]==-1)return(-1);
+  }
+  for (j=0;j<step;j++){
+    float scratch[VQ_COMPACT_MAXDIM];
+    const float *t=entry_values(book,entry[j],scratch,book->dim);
+    for(i=0,o=0;i<book->dim && o+j<n;i++,o+=step)
+      a[o+j]+=t[i];
+  }
+  return(0);
+}
+
+static long decodev_add_any(codebook *book,float *a,oggpack_buffer *b,int n){
+  int i,j,entry;
+  float scratch[VQ_COMPACT_MAXDIM];
+  const float *t;
+
+  for(i=0;i<n;){
+    entry = decode_packed_entry_number(book,b);
+    if(entry==-1)return(-1);
+    t     = entry_values(book,entry,scratch,book->dim);
+    for(j=0;i<n && j<book->dim;)
+      a[i++]+=t[j++];
+  }
+  return(0);
+}
+
+static long decodevs_add_1(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodevs_add_dim(book,a,b,n,1);
+}
+static long decodevs_add_2(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodevs_add_dim(book,a,b,n,2);
+}
+static long decodevs_add_4(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodevs_add_dim(book,a,b,n,4);
+}
+static long decodevs_add_8(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodevs_add_dim(book,a,b,n,8);
+}
+
+static long decodev_add_1(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodev_add_dim(book,a,b,n,1);
+}
+static long decodev_add_2(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodev_add_dim(book,a,b,n,2);
+}
+static long decodev_add_4(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodev_add_dim(book,a,b,n,4);
+}
+static long decodev_add_8(codebook *book,float *a,oggpack_buffer *b,int n){
+  return decodev_add_dim(book,a,b,n,8);
+}
+
+/* called once per book by vorbis_book_init_decode */
+void vorbis_book_select_kernels(codebook *book){
+  switch(book->dim){
+  case 1:
+    book->dec_vsadd=decodevs_add_1;
+    book->dec_vadd=decodev_add_1;
+    break;
+  case 2:
+    book->dec_vsadd=decodevs_add_2;
+    book->dec_vadd=decodev_add_2;
+    break;
+  case 4:
+    book->dec_vsadd=decodevs_add_4;
+    book->dec_vadd=decodev_add_4;
+    break;
+  case 8:
+    book->dec_vsadd=decodevs_add_8;
+    book->dec_vadd=decodev_add_8;
+    break;
+  default:
+    book->dec_vsadd=decodevs_add_any;
+    book->dec_vadd=decodev_add_any;
+    break;
+  }
+}
+
 /* returns 0 on OK or -1 on eof *************************************/
 /* decode vector / dim granularity gaurding is done in the upper layer */
 long vorbis_book_decodevs_add(codebook *book,float *a,oggpack_buffer *b,int n){
   if(book->used_entries>0){
-    int step=n/book->dim;
-    long *entry = alloca(sizeof(*entry)*step);
-    float **t = alloca(sizeof(*t)*step);
-    int i,j,o;
-
-    for (i = 0; i < step; i++) {
-      entry[i]=decode_packed_entry_number(book,b);
-      if(entry[i]==-1)return(-1);
-      t[i] = book->valuelist+entry[i]*book->dim;
-    }
-    for(i=0,o=0;i<book->dim;i++,o+=step)
-      for (j=0;o+j<n && j<step;j++)
-        a[o+j]+=t[j][i];
+    if(n%book->dim==0)
+      return book->dec_vsadd(book,a,b,n);
+    return decodevs_add_any(book,a,b,n);
   }
   return(0);
 }
@@ -395,16 +623,9 @@ long vorbis_book_decodevs_add(codebook *book,float *a,oggpack_buffer *b,int n){
 /* decode vector / dim granularity gaurding is done in the upper layer */
 long vorbis_book_decodev_add(codebook *book,float *a,oggpack_buffer *b,int n){
   if(book->used_entries>0){
-    int i,j,entry;
-    float *t;
-
-    for(i=0;i<n;){
-      entry = decode_packed_entry_number(book,b);
-      if(entry==-1)return(-1);
-      t     = book->valuelist+entry*book->dim;
-      for(j=0;i<n && j<book->dim;)
-        a[i++]+=t[j++];
-    }
+    if(n%book->dim==0)
+      return book->dec_vadd(book,a,b,n);
+    return decodev_add_any(book,a,b,n);
   }
   return(0);
 }
@@ -415,12 +636,13 @@ long vorbis_book_decodev_add(codebook *book,float *a,oggpack_buffer *b,int n){
 long vorbis_book_decodev_set(codebook *book,float *a,oggpack_buffer *b,int n){
   if(book->used_entries>0){
     int i,j,entry;
-    float *t;
+    float scratch[VQ_COMPACT_MAXDIM];
+    const float *t;
 
     for(i=0;i<n;){
       entry = decode_packed_entry_number(book,b);
       if(entry==-1)return(-1);
-      t     = book->valuelist+entry*book->dim;
+      t     = entry_values(book,entry,scratch,book->dim);
       for (j=0;i<n && j<book->dim;){
         a[i++]=t[j++];
       }
@@ -435,6 +657,81 @@ long vorbis_book_decodev_set(codebook *book,float *a,oggpack_buffer *b,int n){
   return(0);
 }
 
+/* residue 2 interleaves all channels into one vector.  Rather than
+   scattering each value to a[chptr][i] as it's decoded, decode a whole
+   partition into a contiguous scratch vector and deinterleave it into
+   the channel vectors afterward; stereo and 5.1 get their own
+   deinterleave loops. */
+
+#define DECODEVV_STACK 256
+
+static void deinterleave_add(float **a,long off,int ch,const float *s,int n){
+  int i,j;
+  switch(ch){
+  case 2:
+    {
+      float *a0=a[0]+off,*a1=a[1]+off;
+      for(i=0;i<(n>>1);i++){
+        a0[i]+=s[0];
+        a1[i]+=s[1];
+        s+=2;
+      }
+    }
+    break;
+  case 6:
+    {
+      float *a0=a[0]+off,*a1=a[1]+off,*a2=a[2]+off;
+      float *a3=a[3]+off,*a4=a[4]+off,*a5=a[5]+off;
+      for(i=0;i<n/6;i++){
+        a0[i]+=s[0];
+        a1[i]+=s[1];
+        a2[i]+=s[2];
+        a3[i]+=s[3];
+        a4[i]+=s[4];
+        a5[i]+=s[5];
+        s+=6;
+      }
+    }
+    break;
+  default:
+    for(j=0;j<ch;j++){
+      float *aj=a[j]+off;
+      for(i=0;i<n/ch;i++)
+        aj[i]+=s[i*ch+j];
+    }
+    break;
+  }
+}
+
+STIN long decodevv_add_batched(codebook *book,float **a,long offset,int ch,
+                               oggpack_buffer *b,int n){
+  const int dim=book->dim;
+  float stack[DECODEVV_STACK];
+  float *s=(n>DECODEVV_STACK ? alloca(sizeof(*s)*n) : stack);
+  int i;
+
+  for(i=0;i<n;i+=dim){
+    long entry=decode_packed_entry_number(book,b);
+    if(entry==-1){
+      /* a truncated packet still contributes what was decoded, as
+         with the unbatched path; round down to whole samples */
+      deinterleave_add(a,offset/ch,ch,s,i-i%ch);
+      if(i%ch){
+        int j;
+        for(j=0;j<i%ch;j++)
+          a[j][(offset+i)/ch]+=s[i-i%ch+j];
+      }
+      return(-1);
+    }
+    if(!book->dec_qlist)
+      memcpy(s+i,book->valuelist+entry*dim,dim*sizeof(*s));
+    else
+      entry_values(book,entry,s+i,dim);
+  }
+  deinterleave_add(a,offset/ch,ch,s,n);
+  return(0);
+}
+
 long vorbis_book_decodevv_add(codebook *book,float **a,long offset,int ch,
                               oggpack_buffer *b,int n){
 
@@ -442,11 +739,16 @@ long vorbis_book_decodevv_add(codebook *book,float **a,long offset,int ch,
   int chptr=0;
   if(book->used_entries>0){
     int m=(offset+n)/ch;
+
+    if(offset%ch==0 && n%ch==0 && n%book->dim==0)
+      return decodevv_add_batched(book,a,offset,ch,b,n);
+
     for(i=offset/ch;i<m;){
       entry = decode_packed_entry_number(book,b);
       if(entry==-1)return(-1);
       {
-        const float *t = book->valuelist+entry*book->dim;
+        float scratch[VQ_COMPACT_MAXDIM];
+        const float *t = entry_values(book,entry,scratch,book->dim);
         for (j=0;i<m && j<book->dim;j++){
           a[chptr++][i]+=t[j];
           if(chptr==ch){
@@ -54,6 +54,8 @@ typedef struct static_codebook{
   int allocedp;
 } static_codebook;
 
+#define VQ_COMPACT_MAXDIM 8
+
 typedef struct codebook{
   long dim;           /* codebook dimensions (elements per vector) */
   long entries;       /* codebook entries */
@@ -72,16 +74,44 @@ typedef struct codebook{
   int           dec_firsttablen;
   int           dec_maxlength;
 
+  /* decode only: if every value of a book of no more than
+     VQ_COMPACT_MAXDIM dimensions lies exactly on dec_qmin+dec_qdelta*k
+     for a small integer k, valuelist is dropped and the k are kept
+     instead, dec_qbytes (1 or 2) bytes each */
+  void         *dec_qlist;
+  int           dec_qbytes;
+  float         dec_qmin;
+  float         dec_qdelta;
+
+  /* decode only: residue add kernels for this book's dimension, set
+     by vorbis_book_init_decode */
+  long (*dec_vadd)(struct codebook *book,float *a,oggpack_buffer *b,int n);
+  long (*dec_vsadd)(struct codebook *book,float *a,oggpack_buffer *b,int n);
+
   /* The current encoder uses only centered, integer-only lattice books. */
   int           quantvals;
   int           minval;
   int           delta;
+
+  /* encode only, for lattice books with unpopulated entries: the
+     populated entries in entry order, their value vectors, and for
+     every lattice point the slot of the populated entry nearest it.
+     Used by the nearest-entry fallback of the residue encoder. */
+  int           enc_populated;
+  int          *enc_entry;
+  int          *enc_value;
+  ogg_int16_t  *enc_seed;
+
+  void         *enc_shared; /* cache entry owning the tables, if any */
 } codebook;
 
 extern void vorbis_staticbook_destroy(static_codebook *b);
 extern int vorbis_book_init_encode(codebook *dest,const static_codebook *source);
 extern int vorbis_book_init_decode(codebook *dest,const static_codebook *source);
+extern int vorbis_book_check_decode(codebook *dest,const static_codebook *source);
 extern void vorbis_book_clear(codebook *b);
+extern int vorbis_book_compact_values(codebook *b);
+extern void vorbis_book_select_kernels(codebook *b);
 
 extern float *_book_unquantize(const static_codebook *b,int n,int *map);
 extern float *_book_logdist(const static_codebook *b,float *vals);
@@ -101,6 +131,19 @@ extern static_codebook *vorbis_staticbook_unpack(oggpack_buffer *b);
 
 extern int vorbis_book_encode(codebook *book, int a, oggpack_buffer *b);
 
+/* runs of codewords collect in a word that goes to the oggpack_buffer
+   32 bits at a time rather than one oggpack_write() per codeword.
+   Flush before anything else writes to the buffer. */
+typedef struct {
+  oggpack_buffer *opb;
+  ogg_uint32_t    word;
+  int             bits;
+} codeword_writer;
+
+extern void vorbis_writer_init(codeword_writer *w,oggpack_buffer *b);
+extern void vorbis_writer_flush(codeword_writer *w);
+extern int  vorbis_book_encodew(codebook *book, int a, codeword_writer *w);
+
 extern long vorbis_book_decode(codebook *book, oggpack_buffer *b);
 extern long vorbis_book_decodevs_add(codebook *book, float *a,
                                      oggpack_buffer *b,int n);
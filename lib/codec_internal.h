@@ -19,6 +19,7 @@
 
 #include "envelope.h"
 #include "codebook.h"
+#include "thread.h"
 
 #define BLOCKTYPE_IMPULSE    0
 #define BLOCKTYPE_PADDING    1
@@ -27,6 +28,8 @@
 
 #define PACKETBLOBS 15
 
+#define ENCODE_MAXTHREADS 64
+
 typedef struct vorbis_block_internal{
   float  **pcmdelay;  /* this is a pointer into local storage */
   float  ampmax;
@@ -36,6 +39,15 @@ typedef struct vorbis_block_internal{
                                               blob [PACKETBLOBS/2] points to
                                               the oggpack_buffer in the
                                               main vorbis_block */
+
+  /* mapping state between the transform and encode phases; managed
+     mode also encodes candidate blobs on demand from it */
+  void          *mapstate;
+  unsigned char  blobready[PACKETBLOBS];
+
+  /* per-channel allocation arenas for threaded analysis */
+  struct vorbis_block *chanblock;
+  int                  chanblocks;
 } vorbis_block_internal;
 
 typedef void vorbis_look_floor;
@@ -62,9 +74,11 @@ typedef struct private_state {
   envelope_lookup        *ve; /* envelope lookup */
   int                     window[2];
   vorbis_look_transform **transform[2];    /* block, type */
-  drft_lookup             fft_look[2];
+  drft_lookup            *fft_look[2];     /* shared; see cache.h */
+  float                  *fft_work;        /* scratch for fft_look */
 
   int                     modebits;
+  unsigned char           books_ready[64]; /* decode: per mode */
   vorbis_look_floor     **flr;
   vorbis_look_residue   **residue;
   vorbis_look_psy        *psy;
@@ -81,6 +95,25 @@ typedef struct private_state {
   bitrate_manager_state bms;
 
   ogg_int64_t sample_count;
+
+  /* samples the encode side v->pcm[] vectors have been advanced past
+     the start of their storage; see vorbis_analysis_buffer() */
+  long pcm_offset;
+
+  /* encode side worker threads (OV_ECTL_THREADS_SET); NULL when
+     encoding on the calling thread only */
+  vorbis_pool  *pool;
+  vorbis_block *blobblock; /* per-blob allocation arenas */
+
+  /* vorbis_analysis_packetout() block pipeline */
+  vorbis_block *pipe;
+  int           pipe_size;
+  int           pipe_fill;  /* blocks out of blockout and transformed */
+  int           pipe_ready; /* of those, encoded */
+  int           pipe_next;  /* next to hand to bitrate management */
+  int          *pipe_ret;
+  float         pipe_ampmax;
+  int           pipelined;  /* encode phases running on the pool */
 } private_state;
 
 /* codec_setup_info contains all the setup information specific to the
@@ -118,6 +151,9 @@ typedef struct codec_setup_info {
   vorbis_info_residue    *residue_param[64];
   static_codebook        *book_param[256];
   codebook               *fullbooks;
+  vorbis_mutex            book_lock; /* guards decode-side fullbooks,
+                                        which are built on first use */
+  int                     books_built; /* decode tables built so far */
 
   vorbis_info_psy        *psy_param[4]; /* encode only */
   vorbis_info_psy_global psy_g_param;
@@ -129,6 +165,8 @@ typedef struct codec_setup_info {
   int         halfrate_flag; /* painless downsample for decode */
 } codec_setup_info;
 
+extern int _vds_build_books(vorbis_dsp_state *v,int mode);
+
 extern vorbis_look_psy_global *_vp_global_look(vorbis_info *vi);
 extern void _vp_global_free(vorbis_look_psy_global *look);
 
@@ -156,7 +194,8 @@ typedef struct {
 
 extern int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
                           const float *logmdct,   /* in */
-                          const float *logmask);
+                          const float *logmask,
+                          int lowpass);
 extern int *floor1_interpolate_fit(vorbis_block *vb,vorbis_look_floor1 *look,
                           int *A,int *B,
                           int del);
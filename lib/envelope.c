@@ -23,18 +23,42 @@
 #include "codec_internal.h"
 
 #include "os.h"
+#include "thread.h"
 #include "scales.h"
 #include "envelope.h"
 #include "mdct.h"
 #include "misc.h"
 
+/* background search thread; scans each time input is posted.  The
+   encoder syncs before anything that moves the PCM or reads the marks,
+   so the scan never sees the buffers change under it */
+static void _ve_envelope_scan(vorbis_dsp_state *v);
+
+static void envelope_main(void *arg){
+  envelope_lookup *e=arg;
+  vorbis_dsp_state *v;
+  _vorbis_mutex_lock(&e->lock);
+  for(;;){
+    while(!e->posted && !e->quit)
+      _vorbis_cond_wait(&e->cond,&e->lock);
+    if(e->quit)break;
+    v=e->posted;
+    _vorbis_mutex_unlock(&e->lock);
+    _ve_envelope_scan(v);
+    _vorbis_mutex_lock(&e->lock);
+    e->posted=NULL;
+    _vorbis_cond_broadcast(&e->cond);
+  }
+  _vorbis_mutex_unlock(&e->lock);
+}
+
 void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi){
   codec_setup_info *ci=vi->codec_setup;
   vorbis_info_psy_global *gi=&ci->psy_g_param;
   int ch=vi->channels;
   int i,j;
   int n=e->winlength=128;
-  e->searchstep=64; /* not random */
+  e->searchstep=VE_SEARCHSTEP;
 
   e->minenergy=gi->preecho_minenergy;
   e->ch=ch;
@@ -70,10 +94,31 @@ void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi){
   e->filter=_ogg_calloc(VE_BANDS*ch,sizeof(*e->filter));
   e->mark=_ogg_calloc(e->storage,sizeof(*e->mark));
 
+  /* with worker threads to spare, search ahead as input arrives.
+     The search thread counts against OV_ECTL_THREADS_SET, so it only
+     runs when the pool still gets a worker of its own. */
+  if(ci->hi.threads>2 && !gi->fixed_blocksize){
+    _vorbis_mutex_init(&e->lock);
+    _vorbis_cond_init(&e->cond);
+    if(_vorbis_thread_create(&e->thread,envelope_main,e)){
+      _vorbis_cond_clear(&e->cond);
+      _vorbis_mutex_clear(&e->lock);
+    }else
+      e->threaded=1;
+  }
 }
 
 void _ve_envelope_clear(envelope_lookup *e){
   int i;
+  if(e->threaded){
+    _vorbis_mutex_lock(&e->lock);
+    e->quit=1;
+    _vorbis_cond_broadcast(&e->cond);
+    _vorbis_mutex_unlock(&e->lock);
+    _vorbis_thread_join(&e->thread);
+    _vorbis_cond_clear(&e->cond);
+    _vorbis_mutex_clear(&e->lock);
+  }
   mdct_clear(&e->mdct);
   for(i=0;i<VE_BANDS;i++)
     _ogg_free(e->band[i].window);
@@ -86,13 +131,16 @@ void _ve_envelope_clear(envelope_lookup *e){
 /* fairly straight threshhold-by-band based until we find something
    that works better and isn't patented. */
 
-static int _ve_amp(envelope_lookup *ve,
-                   vorbis_info_psy_global *gi,
-                   float *data,
-                   envelope_band *bands,
-                   envelope_filter_state *filters){
+/* the part of the analysis that depends only on this channel's
+   signal: window, transform and smooth one search step, leaving the
+   amplitude of each band in acc.  vec is scratch of winlength. */
+static void _ve_bands(envelope_lookup *ve,
+                      float *data,
+                      float *vec,
+                      envelope_band *bands,
+                      envelope_filter_state *filters,
+                      float *acc){
   long n=ve->winlength;
-  int ret=0;
   long i,j;
   float decay;
 
@@ -101,14 +149,7 @@ static int _ve_amp(envelope_lookup *ve,
      itself (for low power signals) */
 
   float minV=ve->minenergy;
-  float *vec=alloca(n*sizeof(*vec));
-
-  /* stretch is used to gradually lengthen the number of windows
-     considered prevoius-to-potential-trigger */
-  int stretch=max(VE_MINSTRETCH,ve->stretch/2);
-  float penalty=gi->stretch_penalty-(ve->stretch/2-VE_MINSTRETCH);
-  if(penalty<0.f)penalty=0.f;
-  if(penalty>gi->stretch_penalty)penalty=gi->stretch_penalty;
+  float *amp=vec+n/2; /* free once transformed */
 
   /*_analysis_output_always("lpcm",seq2,data,n,0,0,
     totalshift+pos*ve->searchstep);*/
@@ -147,51 +188,68 @@ static int _ve_amp(envelope_lookup *ve,
   /* perform spreading and limiting, also smooth the spectrum.  yes,
      the MDCT results in all real coefficients, but it still *behaves*
      like real/imaginary pairs */
-  for(i=0;i<n/2;i+=2){
-    float val=vec[i]*vec[i]+vec[i+1]*vec[i+1];
-    val=todB(&val)*.5f;
+  for(i=0;i<n/4;i++){
+    float val=vec[i*2]*vec[i*2]+vec[i*2+1]*vec[i*2+1];
+    amp[i]=todB(&val)*.5f;
+  }
+  for(i=0;i<n/4;i++){
+    float val=amp[i];
     if(val<decay)val=decay;
     if(val<minV)val=minV;
-    vec[i>>1]=val;
-    decay-=8.;
+    vec[i]=val;
+    decay-=8.f;
   }
 
   /*_analysis_output_always("spread",seq2++,vec,n/4,0,0,0);*/
 
-  /* perform preecho/postecho triggering by band */
+  /* accumulate amplitude by band */
   for(j=0;j<VE_BANDS;j++){
-    float acc=0.;
-    float valmax,valmin;
-
-    /* accumulate amplitude */
+    float a=0.;
     for(i=0;i<bands[j].end;i++)
-      acc+=vec[i+bands[j].begin]*bands[j].window[i];
+      a+=vec[i+bands[j].begin]*bands[j].window[i];
+    acc[j]=a*bands[j].total;
+  }
+}
+
+/* perform preecho/postecho triggering by band; this part depends on
+   the blocking decisions made so far (stretch) */
+static int _ve_trigger(envelope_lookup *ve,
+                       vorbis_info_psy_global *gi,
+                       const float *acc,
+                       envelope_filter_state *filters){
+  int ret=0;
+  long i,j;
 
-    acc*=bands[j].total;
+  /* stretch is used to gradually lengthen the number of windows
+     considered prevoius-to-potential-trigger */
+  int stretch=max(VE_MINSTRETCH,ve->stretch/2);
+  float penalty=gi->stretch_penalty-(ve->stretch/2-VE_MINSTRETCH);
+  if(penalty<0.f)penalty=0.f;
+  if(penalty>gi->stretch_penalty)penalty=gi->stretch_penalty;
 
-    /* convert amplitude to delta */
+  for(j=0;j<VE_BANDS;j++){
+    float valmax,valmin;
+
+    /* convert amplitude to delta.  ampbuf holds the history twice
+       over so the window behind ampptr never wraps */
     {
-      int p,this=filters[j].ampptr;
+      int this=filters[j].ampptr;
+      float *hist=filters[j].ampbuf+this+VE_AMP-1;
       float postmax,postmin,premax=-99999.f,premin=99999.f;
 
-      p=this;
-      p--;
-      if(p<0)p+=VE_AMP;
-      postmax=max(acc,filters[j].ampbuf[p]);
-      postmin=min(acc,filters[j].ampbuf[p]);
-
-      for(i=0;i<stretch;i++){
-        p--;
-        if(p<0)p+=VE_AMP;
-        premax=max(premax,filters[j].ampbuf[p]);
-        premin=min(premin,filters[j].ampbuf[p]);
+      postmax=max(acc[j],hist[0]);
+      postmin=min(acc[j],hist[0]);
+
+      for(i=1;i<=stretch;i++){
+        premax=max(premax,hist[-i]);
+        premin=min(premin,hist[-i]);
       }
 
       valmin=postmin-premin;
       valmax=postmax-premax;
 
       /*filters[j].markers[pos]=valmax;*/
-      filters[j].ampbuf[this]=acc;
+      filters[j].ampbuf[this]=filters[j].ampbuf[this+VE_AMP]=acc[j];
       filters[j].ampptr++;
       if(filters[j].ampptr>=VE_AMP)filters[j].ampptr=0;
     }
@@ -212,7 +270,8 @@ static int seq=0;
 static ogg_int64_t totalshift=-1024;
 #endif
 
-long _ve_envelope_search(vorbis_dsp_state *v){
+/* marks the search steps of all complete windows not yet analyzed */
+static void _ve_envelope_scan(vorbis_dsp_state *v){
   vorbis_info *vi=v->vi;
   codec_setup_info *ci=vi->codec_setup;
   vorbis_info_psy_global *gi=&ci->psy_g_param;
@@ -229,33 +288,65 @@ long _ve_envelope_search(vorbis_dsp_state *v){
     ve->mark=_ogg_realloc(ve->mark,ve->storage*sizeof(*ve->mark));
   }
 
-  for(j=first;j<last;j++){
-    int ret=0;
+  /* the band amplitudes of a channel don't depend on the triggers,
+     so work through VE_BATCH steps a channel at a time before making
+     the blocking decisions in step order */
+  {
+    float *vec=alloca(ve->winlength*sizeof(*vec));
+    float *acc=alloca(VE_BATCH*ve->ch*VE_BANDS*sizeof(*acc));
+    long k,steps;
+
+    for(j=first;j<last;j+=steps){
+      steps=last-j;
+      if(steps>VE_BATCH)steps=VE_BATCH;
+
+      for(i=0;i<ve->ch;i++){
+        float *pcm=v->pcm[i]+ve->searchstep*j;
+        for(k=0;k<steps;k++,pcm+=ve->searchstep)
+          _ve_bands(ve,pcm,vec,ve->band,ve->filter+i*VE_BANDS,
+                    acc+(k*ve->ch+i)*VE_BANDS);
+      }
 
-    ve->stretch++;
-    if(ve->stretch>VE_MAXSTRETCH*2)
-      ve->stretch=VE_MAXSTRETCH*2;
+      for(k=0;k<steps;k++){
+        long s=j+k;
+        int ret=0;
 
-    for(i=0;i<ve->ch;i++){
-      float *pcm=v->pcm[i]+ve->searchstep*(j);
-      ret|=_ve_amp(ve,gi,pcm,ve->band,ve->filter+i*VE_BANDS);
-    }
+        ve->stretch++;
+        if(ve->stretch>VE_MAXSTRETCH*2)
+          ve->stretch=VE_MAXSTRETCH*2;
 
-    ve->mark[j+VE_POST]=0;
-    if(ret&1){
-      ve->mark[j]=1;
-      ve->mark[j+1]=1;
-    }
+        for(i=0;i<ve->ch;i++)
+          ret|=_ve_trigger(ve,gi,acc+(k*ve->ch+i)*VE_BANDS,
+                           ve->filter+i*VE_BANDS);
 
-    if(ret&2){
-      ve->mark[j]=1;
-      if(j>0)ve->mark[j-1]=1;
-    }
+        ve->mark[s+VE_POST]=0;
+        if(ret&1){
+          ve->mark[s]=1;
+          ve->mark[s+1]=1;
+        }
 
-    if(ret&4)ve->stretch=-1;
+        if(ret&2){
+          ve->mark[s]=1;
+          if(s>0)ve->mark[s-1]=1;
+        }
+
+        if(ret&4)ve->stretch=-1;
+      }
+    }
   }
 
   ve->current=last*ve->searchstep;
+}
+
+long _ve_envelope_search(vorbis_dsp_state *v){
+  vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  envelope_lookup *ve=((private_state *)(v->backend_state))->ve;
+  long j;
+
+  /* pick up whatever a background scan hasn't covered */
+  _ve_envelope_sync(ve);
+  _ve_envelope_scan(v);
 
   {
     long centerW=v->centerW;
@@ -326,6 +417,25 @@ long _ve_envelope_search(vorbis_dsp_state *v){
   return(-1);
 }
 
+void _ve_envelope_post(vorbis_dsp_state *v){
+  envelope_lookup *e=((private_state *)(v->backend_state))->ve;
+  if(e->threaded){
+    _vorbis_mutex_lock(&e->lock);
+    e->posted=v;
+    _vorbis_cond_broadcast(&e->cond);
+    _vorbis_mutex_unlock(&e->lock);
+  }
+}
+
+void _ve_envelope_sync(envelope_lookup *e){
+  if(e->threaded){
+    _vorbis_mutex_lock(&e->lock);
+    while(e->posted)
+      _vorbis_cond_wait(&e->cond,&e->lock);
+    _vorbis_mutex_unlock(&e->lock);
+  }
+}
+
 int _ve_envelope_mark(vorbis_dsp_state *v){
   envelope_lookup *ve=((private_state *)(v->backend_state))->ve;
   vorbis_info *vi=v->vi;
@@ -18,20 +18,23 @@
 #define _V_ENVELOPE_
 
 #include "mdct.h"
+#include "thread.h"
 
 #define VE_PRE    16
 #define VE_WIN    4
 #define VE_POST   2
+#define VE_SEARCHSTEP 64 /* not random */
 #define VE_AMP    (VE_PRE+VE_POST-1)
 
 #define VE_BANDS  7
 #define VE_NEARDC 15
+#define VE_BATCH  32  /* search steps analyzed per pass */
 
 #define VE_MINSTRETCH 2   /* a bit less than short block */
 #define VE_MAXSTRETCH 12  /* one-third full block */
 
 typedef struct {
-  float ampbuf[VE_AMP];
+  float ampbuf[VE_AMP*2];
   int   ampptr;
 
   float nearDC[VE_NEARDC];
@@ -67,12 +70,23 @@ typedef struct {
   long current;
   long curmark;
   long cursor;
+
+  /* background search, only when the encoder has worker threads */
+  int               threaded;
+  vorbis_thread     thread;
+  vorbis_mutex      lock;
+  vorbis_cond       cond;
+  vorbis_dsp_state *posted; /* input to scan; NULL once scanned */
+  int               quit;
 } envelope_lookup;
 
 extern void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi);
 extern void _ve_envelope_clear(envelope_lookup *e);
 extern long _ve_envelope_search(vorbis_dsp_state *v);
 extern void _ve_envelope_shift(envelope_lookup *e,long shift);
+/* start a background scan of the input written so far / wait for it */
+extern void _ve_envelope_post(vorbis_dsp_state *v);
+extern void _ve_envelope_sync(envelope_lookup *e);
 extern int  _ve_envelope_mark(vorbis_dsp_state *v);
 
 
@@ -22,6 +22,7 @@
 #include "codec_internal.h"
 #include "registry.h"
 #include "codebook.h"
+#include "os.h"
 #include "misc.h"
 #include "scales.h"
 
@@ -402,10 +403,11 @@ static void render_line0(int n, int x0,int x1,int y0,int y1,int *d){
   }
 }
 
-/* the floor has already been filtered to only include relevant sections */
-static int accumulate_fit(const float *flr,const float *mdct,
-                          int x0, int x1,lsfit_acc *a,
-                          int n,vorbis_info_floor1 *info){
+/* the floor has already been filtered to only include relevant sections.
+   quant[] is the quantized floor, strong[] flags the bins where the
+   signal reaches it; see floor1_fit() */
+static int accumulate_fit(const int *quant,const unsigned char *strong,
+                          int x0, int x1,lsfit_acc *a,int n){
   long i;
 
   int xa=0,ya=0,x2a=0,y2a=0,xya=0,na=0, xb=0,yb=0,x2b=0,y2b=0,xyb=0,nb=0;
@@ -416,9 +418,9 @@ static int accumulate_fit(const float *flr,const float *mdct,
   if(x1>=n)x1=n-1;
 
   for(i=x0;i<=x1;i++){
-    int quantized=vorbis_dBquant(flr+i);
+    int quantized=quant[i];
     if(quantized){
-      if(mdct[i]+info->twofitatten>=flr[i]){
+      if(strong[i]){
         xa  += i;
         ya  += quantized;
         x2a += i*i;
@@ -513,8 +515,8 @@ static int fit_line(lsfit_acc *a,int fits,int *y0,int *y1,
   }
 }
 
-static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
-                         const float *mdct,
+static int inspect_error(int x0,int x1,int y0,int y1,const int *quant,
+                         const unsigned char *strong,int limit,
                          vorbis_info_floor1 *info){
   int dy=y1-y0;
   int adx=x1-x0;
@@ -524,16 +526,21 @@ static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
   int x=x0;
   int y=y0;
   int err=0;
-  int val=vorbis_dBquant(mask+x);
+  int val;
   int mse=0;
   int n=0;
 
+  /* nothing is analyzed past the lowpass */
+  if(x0>=limit)return(0);
+  if(x1>limit)x1=limit;
+  val=quant[x];
+
   ady-=abs(base*adx);
 
   mse=(y-val);
   mse*=mse;
   n++;
-  if(mdct[x]+info->twofitatten>=mask[x]){
+  if(strong[x]){
     if(y+info->maxover<val)return(1);
     if(y-info->maxunder>val)return(1);
   }
@@ -547,10 +554,10 @@ static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
       y+=base;
     }
 
-    val=vorbis_dBquant(mask+x);
+    val=quant[x];
     mse+=((y-val)*(y-val));
     n++;
-    if(mdct[x]+info->twofitatten>=mask[x]){
+    if(strong[x]){
       if(val){
         if(y+info->maxover<val)return(1);
         if(y-info->maxunder>val)return(1);
@@ -575,10 +582,11 @@ static int post_Y(int *A,int *B,int pos){
 
 int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
                           const float *logmdct,   /* in */
-                          const float *logmask){
+                          const float *logmask,
+                          int lowpass){           /* fit [0,lowpass) */
   long i,j;
   vorbis_info_floor1 *info=look->vi;
-  long n=look->n;
+  long n=(lowpass<look->n ? lowpass : look->n);
   long posts=look->posts;
   long nonzero=0;
   lsfit_acc fits[VIF_POSIT+1];
@@ -590,6 +598,15 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
   int *output=NULL;
   int memo[VIF_POSIT+2];
 
+  /* the line fits and error checks below revisit bins many times;
+     quantize the mask and compare it against the signal once */
+  int *quant=alloca(n*sizeof(*quant));
+  unsigned char *strong=alloca(n*sizeof(*strong));
+  for(i=0;i<n;i++){
+    quant[i]=vorbis_dBquant(logmask+i);
+    strong[i]=(logmdct[i]+info->twofitatten>=logmask[i]);
+  }
+
   for(i=0;i<posts;i++)fit_valueA[i]=-200; /* mark all unused */
   for(i=0;i<posts;i++)fit_valueB[i]=-200; /* mark all unused */
   for(i=0;i<posts;i++)loneighbor[i]=0; /* 0 for the implicit 0 post */
@@ -599,12 +616,11 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
   /* quantize the relevant floor points and collect them into line fit
      structures (one per minimal division) at the same time */
   if(posts==0){
-    nonzero+=accumulate_fit(logmask,logmdct,0,n,fits,n,info);
+    nonzero+=accumulate_fit(quant,strong,0,n,fits,n);
   }else{
     for(i=0;i<posts-1;i++)
-      nonzero+=accumulate_fit(logmask,logmdct,look->sorted_index[i],
-                              look->sorted_index[i+1],fits+i,
-                              n,info);
+      nonzero+=accumulate_fit(quant,strong,look->sorted_index[i],
+                              look->sorted_index[i+1],fits+i,n);
   }
 
   if(nonzero){
@@ -645,7 +661,7 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
             exit(1);
           }
 
-          if(inspect_error(lx,hx,ly,hy,logmask,logmdct,info)){
+          if(inspect_error(lx,hx,ly,hy,quant,strong,n,info)){
             /* outside error bounds/begin search area.  Split it. */
             int ly0=-200;
             int ly1=-200;
@@ -761,6 +777,7 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
   int out[VIF_POSIT+2];
   static_codebook **sbooks=ci->book_param;
   codebook *books=ci->fullbooks;
+  codeword_writer w;
 
   /* quantize values to multiplier spec */
   if(post){
@@ -835,11 +852,13 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
     oggpack_write(opb,1,1);
 
     /* beginning/end post */
+#ifdef TRAIN_FLOOR1
     look->frames++;
     look->postbits+=ov_ilog(look->quant_q-1)*2;
+#endif
     oggpack_write(opb,out[0],ov_ilog(look->quant_q-1));
     oggpack_write(opb,out[1],ov_ilog(look->quant_q-1));
-
+    vorbis_writer_init(&w,opb);
 
     /* partition by partition */
     for(i=0,j=2;i<info->partitions;i++){
@@ -877,8 +896,12 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
           cshift+=csubbits;
         }
         /* write it */
+#ifdef TRAIN_FLOOR1
         look->phrasebits+=
-          vorbis_book_encode(books+info->class_book[class],cval,opb);
+          vorbis_book_encodew(books+info->class_book[class],cval,&w);
+#else
+        vorbis_book_encodew(books+info->class_book[class],cval,&w);
+#endif
 
 #ifdef TRAIN_FLOOR1
         {
@@ -898,9 +921,13 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
         int book=info->class_subbook[class][bookas[k]];
         if(book>=0){
           /* hack to allow training with 'bad' books */
-          if(out[j+k]<(books+book)->entries)
-            look->postbits+=vorbis_book_encode(books+book,
-                                               out[j+k],opb);
+          if(out[j+k]<(books+book)->entries){
+#ifdef TRAIN_FLOOR1
+            look->postbits+=vorbis_book_encodew(books+book,out[j+k],&w);
+#else
+            vorbis_book_encodew(books+book,out[j+k],&w);
+#endif
+          }
           /*else
             fprintf(stderr,"+!");*/
 
@@ -919,6 +946,7 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
       }
       j+=cdim;
     }
+    vorbis_writer_flush(&w);
 
     {
       /* generate quantized floor equivalent to what we'd unpack in decode */
@@ -54,4 +54,8 @@ typedef struct highlevel_encode_setup {
 
   highlevel_byblocktype block[4]; /* padding, impulse, transition, long */
 
+  int threads; /* not a bitstream setting; see OV_ECTL_THREADS_SET */
+  int speed;   /* see OV_ECTL_SPEED_SET */
+  int low_latency_p;
+
 } highlevel_encode_setup;
@@ -17,6 +17,7 @@
 /* general handling of the header and the vorbis_info structure (and
    substructures) */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ogg/ogg.h>
@@ -28,6 +29,7 @@
 #include "psy.h"
 #include "misc.h"
 #include "os.h"
+#include "cache.h"
 
 #define GENERAL_VENDOR_STRING "Xiph.Org libVorbis 1.3.7"
 #define ENCODE_VENDOR_STRING "Xiph.Org libVorbis I 20200704 (Reducing Environment)"
@@ -151,8 +153,10 @@ int vorbis_info_blocksize(vorbis_info *vi,int zo){
 
 /* used by synthesis, which has a full, alloced vi */
 void vorbis_info_init(vorbis_info *vi){
+  codec_setup_info *ci;
   memset(vi,0,sizeof(*vi));
-  vi->codec_setup=_ogg_calloc(1,sizeof(codec_setup_info));
+  vi->codec_setup=ci=_ogg_calloc(1,sizeof(*ci));
+  _vorbis_mutex_init(&ci->book_lock);
 }
 
 void vorbis_info_clear(vorbis_info *vi){
@@ -190,12 +194,19 @@ void vorbis_info_clear(vorbis_info *vi){
       if(ci->fullbooks)
         vorbis_book_clear(ci->fullbooks+i);
     }
-    if(ci->fullbooks)
-        _ogg_free(ci->fullbooks);
+    if(ci->fullbooks){
+#ifdef ANALYSIS
+      /* the encoder builds every book up front; for a decoder this
+         is how many _vds_build_books never needed */
+      fprintf(stderr,"%d of %d codebooks built\n",ci->books_built,ci->books);
+#endif
+      _ogg_free(ci->fullbooks);
+    }
 
     for(i=0;i<ci->psys;i++)
       _vi_psy_free(ci->psy_param[i]);
 
+    _vorbis_mutex_clear(&ci->book_lock);
     _ogg_free(ci);
   }
 
@@ -586,6 +597,57 @@ int vorbis_commentheader_out(vorbis_comment *vc,
   return 0;
 }
 
+/* The setup header of a stream made by vorbis_encode_setup_init()
+   follows from its channels and rate and from the highlevel settings
+   that choose and interpolate the template, so the packed packet is
+   cached under those.  A new setting that changes the books, floors,
+   residues or mappings vorbisenc.c sets up has to be added here.  The
+   key is zeroed before it's filled in, so padding compares equal. */
+typedef struct {
+  const void *setup;  /* template; they're static, so the address
+                         names one */
+  double base_setting;
+  double trigger_setting;
+  double stereo_point_setting;
+  double lowpass_kHz;
+  long   rate;
+  int    channels;
+  int    managed;
+} header_key;
+
+typedef struct {
+  long           bytes;
+  unsigned char *packet;
+} header_packet;
+
+static void *_header_build(void *vi){
+  header_packet *h=NULL;
+  oggpack_buffer opb;
+
+  oggpack_writeinit(&opb);
+  if(!_vorbis_pack_books(&opb,vi)){
+    h=_ogg_malloc(sizeof(*h));
+    if(h){
+      h->bytes=oggpack_bytes(&opb);
+      h->packet=_ogg_malloc(h->bytes);
+      if(h->packet)
+        memcpy(h->packet,opb.buffer,h->bytes);
+      else{
+        _ogg_free(h);
+        h=NULL;
+      }
+    }
+  }
+  oggpack_writeclear(&opb);
+  return h;
+}
+
+static void _header_destroy(void *d){
+  header_packet *h=d;
+  _ogg_free(h->packet);
+  _ogg_free(h);
+}
+
 int vorbis_analysis_headerout(vorbis_dsp_state *v,
                               vorbis_comment *vc,
                               ogg_packet *op,
@@ -593,8 +655,10 @@ int vorbis_analysis_headerout(vorbis_dsp_state *v,
                               ogg_packet *op_code){
   int ret=OV_EIMPL;
   vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
   oggpack_buffer opb;
   private_state *b=v->backend_state;
+  header_packet *code=NULL;
 
   if(!b||vi->channels<=0||vi->channels>256){
     b = NULL;
@@ -635,14 +699,36 @@ int vorbis_analysis_headerout(vorbis_dsp_state *v,
 
   /* third header packet (modes/codebooks) ****************************/
 
-  oggpack_reset(&opb);
-  if(_vorbis_pack_books(&opb,vi))goto err_out;
+  if(ci->hi.set_in_stone && ci->hi.setup){
+    header_key key;
+    memset(&key,0,sizeof(key));
+    key.setup=ci->hi.setup;
+    key.base_setting=ci->hi.base_setting;
+    key.trigger_setting=ci->hi.trigger_setting;
+    key.stereo_point_setting=ci->hi.stereo_point_setting;
+    key.lowpass_kHz=ci->hi.lowpass_kHz;
+    key.rate=vi->rate;
+    key.channels=vi->channels;
+    key.managed=ci->hi.managed;
+    code=_vorbis_cache_get(VC_HEADER,&key,sizeof(key),
+                           _header_build,vi,_header_destroy);
+  }
 
   if(b->header2)_ogg_free(b->header2);
-  b->header2=_ogg_malloc(oggpack_bytes(&opb));
-  memcpy(b->header2,opb.buffer,oggpack_bytes(&opb));
+  if(code){
+    b->header2=_ogg_malloc(code->bytes);
+    memcpy(b->header2,code->packet,code->bytes);
+    op_code->bytes=code->bytes;
+    _vorbis_cache_release(code);
+  }else{
+    oggpack_reset(&opb);
+    if(_vorbis_pack_books(&opb,vi))goto err_out;
+
+    b->header2=_ogg_malloc(oggpack_bytes(&opb));
+    memcpy(b->header2,opb.buffer,oggpack_bytes(&opb));
+    op_code->bytes=oggpack_bytes(&opb);
+  }
   op_code->packet=b->header2;
-  op_code->bytes=oggpack_bytes(&opb);
   op_code->b_o_s=0;
   op_code->e_o_s=0;
   op_code->granulepos=0;
@@ -227,357 +227,694 @@ static float FLOOR1_fromdB_LOOKUP[256]={
 #endif
 
 
-static int mapping0_forward(vorbis_block *vb){
+/* forward state carried from the transform to the encode phase, and
+   on to bitrate management for blobs encoded on demand */
+typedef struct {
+  vorbis_block         *vb;
+  vorbis_info_mapping0 *info;
+  vorbis_look_psy      *psy_look;
+  float               **gmdct;
+  float                *local_ampmax;
+  float                 global_ampmax;
+  float                *work;     /* per-channel scratch when threaded */
+  int                ***floor_posts;
+  int                  *nonzero[PACKETBLOBS];
+  int                 **iwork[PACKETBLOBS];
+  int                   lo;
+  int                   resend;   /* last bin any residue codes, +1 */
+} mapping0_state;
+
+/* encode packet blob k from the finished floor fits.  wb supplies
+   working storage; it is the block itself when encoding serially */
+static void mapping0_encode_blob(mapping0_state *bl,vorbis_block *wb,
+                                 int k,int **iwork,int *nonzero){
+  vorbis_block          *vb=bl->vb;
   vorbis_dsp_state      *vd=vb->vd;
   vorbis_info           *vi=vd->vi;
   codec_setup_info      *ci=vi->codec_setup;
-  private_state         *b=vb->vd->backend_state;
+  private_state         *b=vd->backend_state;
   vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
-  int                    n=vb->pcmend;
-  int i,j,k;
-
-  int    *nonzero    = alloca(sizeof(*nonzero)*vi->channels);
-  float  **gmdct     = _vorbis_block_alloc(vb,vi->channels*sizeof(*gmdct));
-  int    **iwork      = _vorbis_block_alloc(vb,vi->channels*sizeof(*iwork));
-  int ***floor_posts = _vorbis_block_alloc(vb,vi->channels*sizeof(*floor_posts));
+  vorbis_info_mapping0  *info=bl->info;
+  int                    modenumber=vb->W;
+  int                    i,j;
+
+  int **couple_bundle=alloca(sizeof(*couple_bundle)*vi->channels);
+  int *zerobundle=alloca(sizeof(*zerobundle)*vi->channels);
+  oggpack_buffer *opb=vbi->packetblob[k];
+
+  /* start out our new packet blob with packet type and mode */
+  /* Encode the packet type */
+  oggpack_write(opb,0,1);
+  /* Encode the modenumber */
+  /* Encode frame mode, pre,post windowsize, then dispatch */
+  oggpack_write(opb,modenumber,b->modebits);
+  if(vb->W){
+    oggpack_write(opb,vb->lW,1);
+    oggpack_write(opb,vb->nW,1);
+  }
 
-  float global_ampmax=vbi->ampmax;
-  float *local_ampmax=alloca(sizeof(*local_ampmax)*vi->channels);
-  int blocktype=vbi->blocktype;
+  /* encode floor, compute masking curve, sep out residue */
+  for(i=0;i<vi->channels;i++){
+    int submap=info->chmuxlist[i];
+    int *ilogmask=iwork[i];
 
-  int modenumber=vb->W;
-  vorbis_info_mapping0 *info=ci->map_param[modenumber];
-  vorbis_look_psy *psy_look=b->psy+blocktype+(vb->W?2:0);
+    nonzero[i]=floor1_encode(opb,wb,b->flr[info->floorsubmap[submap]],
+                             bl->floor_posts[i][k],
+                             ilogmask);
+#if 0
+    {
+      char buf[80];
+      sprintf(buf,"maskI%c%d",i?'R':'L',k);
+      float work[n/2];
+      for(j=0;j<n/2;j++)
+        work[j]=FLOOR1_fromdB_LOOKUP[iwork[i][j]];
+      _analysis_output(buf,seq,work,n/2,1,1,0);
+    }
+#endif
+  }
 
-  vb->mode=modenumber;
+  /* our iteration is now based on masking curve, not prequant and
+     coupling.  Only one prequant/coupling step */
+
+  /* quantize/couple */
+  /* incomplete implementation that assumes the tree is all depth
+     one, or no tree at all */
+  _vp_couple_quantize_normalize(k,
+                                &ci->psy_g_param,
+                                bl->psy_look,
+                                info,
+                                bl->gmdct,
+                                iwork,
+                                nonzero,
+                                ci->psy_g_param.sliding_lowpass[vb->W][k],
+                                bl->resend,
+                                vi->channels);
 
+#if 0
   for(i=0;i<vi->channels;i++){
-    float scale=4.f/n;
-    float scale_dB;
+    char buf[80];
+    sprintf(buf,"res%c%d",i?'R':'L',k);
+    float work[n/2];
+    for(j=0;j<n/2;j++)
+      work[j]=iwork[i][j];
+    _analysis_output(buf,seq,work,n/2,1,0,0);
+  }
+#endif
 
-    float *pcm     =vb->pcm[i];
-    float *logfft  =pcm;
+  /* classify and encode by submap */
+  for(i=0;i<info->submaps;i++){
+    int ch_in_bundle=0;
+    long **classifications;
+    int resnum=info->residuesubmap[i];
 
-    iwork[i]=_vorbis_block_alloc(vb,n/2*sizeof(**iwork));
-    gmdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(**gmdct));
+    for(j=0;j<vi->channels;j++){
+      if(info->chmuxlist[j]==i){
+        zerobundle[ch_in_bundle]=0;
+        if(nonzero[j])zerobundle[ch_in_bundle]=1;
+        couple_bundle[ch_in_bundle++]=iwork[j];
+      }
+    }
 
-    scale_dB=todB(&scale) + .345; /* + .345 is a hack; the original
-                                     todB estimation used on IEEE 754
-                                     compliant machines had a bug that
-                                     returned dB values about a third
-                                     of a decibel too high.  The bug
-                                     was harmless because tunings
-                                     implicitly took that into
-                                     account.  However, fixing the bug
-                                     in the estimator requires
-                                     changing all the tunings as well.
-                                     For now, it's easier to sync
-                                     things back up here, and
-                                     recalibrate the tunings in the
-                                     next major model upgrade. */
+    classifications=_residue_P[ci->residue_type[resnum]]->
+      class(wb,b->residue[resnum],couple_bundle,zerobundle,ch_in_bundle);
 
-#if 0
-    if(vi->channels==2){
-      if(i==0)
-        _analysis_output("pcmL",seq,pcm,n,0,0,total-n/2);
-      else
-        _analysis_output("pcmR",seq,pcm,n,0,0,total-n/2);
-    }else{
-      _analysis_output("pcm",seq,pcm,n,0,0,total-n/2);
+    ch_in_bundle=0;
+    for(j=0;j<vi->channels;j++)
+      if(info->chmuxlist[j]==i)
+        couple_bundle[ch_in_bundle++]=iwork[j];
+
+    _residue_P[ci->residue_type[resnum]]->
+      forward(opb,wb,b->residue[resnum],
+              couple_bundle,zerobundle,ch_in_bundle,classifications,i);
+  }
+
+  /* ok, done encoding.  Next protopacket. */
+}
+
+/* pool job; each blob allocates from its own scratch block, which
+   borrows the geometry of the block being encoded */
+static void mapping0_blob_job(void *arg,int job){
+  mapping0_state *bl=arg;
+  vorbis_block   *vb=bl->vb;
+  private_state  *b=vb->vd->backend_state;
+  int             k=bl->lo+job;
+  vorbis_block   *wb=b->blobblock+k;
+
+  _vorbis_block_ripcord(wb);
+  wb->lW=vb->lW;
+  wb->W=vb->W;
+  wb->nW=vb->nW;
+  wb->pcmend=vb->pcmend;
+  wb->mode=vb->mode;
+  wb->vd=vb->vd;
+
+  mapping0_encode_blob(bl,wb,k,bl->iwork[k],bl->nonzero[k]);
+  ((vorbis_block_internal *)vb->internal)->blobready[k]=1;
+}
+
+/* bitrate management asks for candidates beyond those encoded up
+   front; finish them serially in the block's own storage */
+static int mapping0_blob(vorbis_block *vb,int k){
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  mapping0_state *bl=vbi->mapstate;
+
+  if(k<0 || k>=PACKETBLOBS || !bl)return(-1);
+  if(!vbi->blobready[k]){
+    mapping0_encode_blob(bl,vb,k,bl->iwork[k],bl->nonzero[k]);
+    vbi->blobready[k]=1;
+  }
+  return(0);
+}
+
+/* one past the last bin any residue of the mapping codes, per channel */
+static int mapping0_residue_end(vorbis_block *vb,vorbis_info_mapping0 *info){
+  vorbis_info      *vi=vb->vd->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  int               n=vb->pcmend/2;
+  long              end=0;
+  int               i,j;
+
+  for(i=0;i<info->submaps;i++){
+    int resno=info->residuesubmap[i];
+    vorbis_info_residue0 *r=ci->residue_param[resno];
+    long e=r->end;
+
+    if(ci->residue_type[resno]==2){
+      /* interleaved; spread over the submap's channels */
+      int ch=0;
+      for(j=0;j<vi->channels;j++)
+        if(info->chmuxlist[j]==i)ch++;
+      if(ch)e=(e+ch-1)/ch;
     }
+    if(e>end)end=e;
+  }
+
+  return(end<n ? end : n);
+}
+
+/* window and transform one channel and find its peak.  work, if not
+   NULL, is n floats of FFT scratch private to the caller */
+static void mapping0_transform_channel(mapping0_state *st,int i,
+                                       float *work){
+  vorbis_block          *vb=st->vb;
+  vorbis_dsp_state      *vd=vb->vd;
+  vorbis_info           *vi=vd->vi;
+  codec_setup_info      *ci=vi->codec_setup;
+  private_state         *b=vd->backend_state;
+  float                 *local_ampmax=st->local_ampmax;
+  int                    n=vb->pcmend;
+  int                    j;
+
+  float scale=4.f/n;
+  float scale_dB;
+  float ampmax; /* kept out of memory so the dB loops vectorize */
+
+  float *pcm     =vb->pcm[i];
+  float *logfft  =pcm;
+
+  scale_dB=todB(&scale) + .345; /* + .345 is a hack; the original
+                                   todB estimation used on IEEE 754
+                                   compliant machines had a bug that
+                                   returned dB values about a third
+                                   of a decibel too high.  The bug
+                                   was harmless because tunings
+                                   implicitly took that into
+                                   account.  However, fixing the bug
+                                   in the estimator requires
+                                   changing all the tunings as well.
+                                   For now, it's easier to sync
+                                   things back up here, and
+                                   recalibrate the tunings in the
+                                   next major model upgrade. */
+
+#if 0
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("pcmL",seq,pcm,n,0,0,total-n/2);
+    else
+      _analysis_output("pcmR",seq,pcm,n,0,0,total-n/2);
+  }else{
+    _analysis_output("pcm",seq,pcm,n,0,0,total-n/2);
+  }
 #endif
 
-    /* window the PCM data */
-    _vorbis_apply_window(pcm,b->window,ci->blocksizes,vb->lW,vb->W,vb->nW);
+  /* window the PCM data */
+  _vorbis_apply_window(pcm,b->window,ci->blocksizes,vb->lW,vb->W,vb->nW);
 
 #if 0
-    if(vi->channels==2){
-      if(i==0)
-        _analysis_output("windowedL",seq,pcm,n,0,0,total-n/2);
-      else
-        _analysis_output("windowedR",seq,pcm,n,0,0,total-n/2);
-    }else{
-      _analysis_output("windowed",seq,pcm,n,0,0,total-n/2);
-    }
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("windowedL",seq,pcm,n,0,0,total-n/2);
+    else
+      _analysis_output("windowedR",seq,pcm,n,0,0,total-n/2);
+  }else{
+    _analysis_output("windowed",seq,pcm,n,0,0,total-n/2);
+  }
 #endif
 
-    /* transform the PCM data */
-    /* only MDCT right now.... */
-    mdct_forward(b->transform[vb->W][0],pcm,gmdct[i]);
-
-    /* FFT yields more accurate tonal estimation (not phase sensitive) */
-    drft_forward(&b->fft_look[vb->W],pcm);
-    logfft[0]=scale_dB+todB(pcm)  + .345; /* + .345 is a hack; the
-                                     original todB estimation used on
-                                     IEEE 754 compliant machines had a
-                                     bug that returned dB values about
-                                     a third of a decibel too high.
-                                     The bug was harmless because
-                                     tunings implicitly took that into
-                                     account.  However, fixing the bug
-                                     in the estimator requires
-                                     changing all the tunings as well.
-                                     For now, it's easier to sync
-                                     things back up here, and
-                                     recalibrate the tunings in the
-                                     next major model upgrade. */
-    local_ampmax[i]=logfft[0];
-    for(j=1;j<n-1;j+=2){
-      float temp=pcm[j]*pcm[j]+pcm[j+1]*pcm[j+1];
-      temp=logfft[(j+1)>>1]=scale_dB+.5f*todB(&temp)  + .345; /* +
-                                     .345 is a hack; the original todB
-                                     estimation used on IEEE 754
-                                     compliant machines had a bug that
-                                     returned dB values about a third
-                                     of a decibel too high.  The bug
-                                     was harmless because tunings
-                                     implicitly took that into
-                                     account.  However, fixing the bug
-                                     in the estimator requires
-                                     changing all the tunings as well.
-                                     For now, it's easier to sync
-                                     things back up here, and
-                                     recalibrate the tunings in the
-                                     next major model upgrade. */
-      if(temp>local_ampmax[i])local_ampmax[i]=temp;
+  /* transform the PCM data */
+  /* only MDCT right now.... */
+  mdct_forward(b->transform[vb->W][0],pcm,st->gmdct[i]);
+
+  if(ci->psy_g_param.mdct_tonemask){
+    /* cheaper, phase sensitive tonal estimate from the MDCT itself.
+       No scale_dB: mdct_forward already scales by the same 4/n.  A
+       tone's MDCT coefficient is the projection of the windowed
+       spectrum whose magnitude the FFT path takes, so its peak lands
+       between about 5 dB below and 0.5 dB above the FFT level the
+       tone masks are tuned for, depending on phase.  Tones are
+       undermasked at worst, the quality that speed level 2 trades. */
+    float *mdct=st->gmdct[i];
+    ampmax=logfft[0]=todB(mdct)  + .345;
+    for(j=1;j<n/2;j++){
+      float temp=logfft[j]=todB(mdct+j)  + .345;
+      if(temp>ampmax)ampmax=temp;
     }
+    local_ampmax[i]=(ampmax>0.f?0.f:ampmax);
+    return;
+  }
 
-    if(local_ampmax[i]>0.f)local_ampmax[i]=0.f;
-    if(local_ampmax[i]>global_ampmax)global_ampmax=local_ampmax[i];
+  /* FFT yields more accurate tonal estimation (not phase sensitive) */
+  if(!work)work=b->fft_work;
+  drft_forward_work(b->fft_look[vb->W],pcm,work);
+  logfft[0]=scale_dB+todB(pcm)  + .345; /* + .345 is a hack; the
+                                   original todB estimation used on
+                                   IEEE 754 compliant machines had a
+                                   bug that returned dB values about
+                                   a third of a decibel too high.
+                                   The bug was harmless because
+                                   tunings implicitly took that into
+                                   account.  However, fixing the bug
+                                   in the estimator requires
+                                   changing all the tunings as well.
+                                   For now, it's easier to sync
+                                   things back up here, and
+                                   recalibrate the tunings in the
+                                   next major model upgrade. */
+  ampmax=logfft[0];
+
+  /* power of each bin into the (now free) FFT scratch first; written
+     back in place, the dB pass would not vectorize */
+  for(j=1;j<n/2;j++)
+    work[j]=pcm[j*2-1]*pcm[j*2-1]+pcm[j*2]*pcm[j*2];
+  for(j=1;j<n/2;j++){
+    float temp=logfft[j]=scale_dB+.5f*todB(work+j)  + .345; /* +
+                                   .345 is a hack; the original todB
+                                   estimation used on IEEE 754
+                                   compliant machines had a bug that
+                                   returned dB values about a third
+                                   of a decibel too high.  The bug
+                                   was harmless because tunings
+                                   implicitly took that into
+                                   account.  However, fixing the bug
+                                   in the estimator requires
+                                   changing all the tunings as well.
+                                   For now, it's easier to sync
+                                   things back up here, and
+                                   recalibrate the tunings in the
+                                   next major model upgrade. */
+    if(temp>ampmax)ampmax=temp;
+  }
+
+  local_ampmax[i]=(ampmax>0.f?0.f:ampmax);
 
 #if 0
-    if(vi->channels==2){
-      if(i==0){
-        _analysis_output("fftL",seq,logfft,n/2,1,0,0);
-      }else{
-        _analysis_output("fftR",seq,logfft,n/2,1,0,0);
-      }
+  if(vi->channels==2){
+    if(i==0){
+      _analysis_output("fftL",seq,logfft,n/2,1,0,0);
     }else{
-      _analysis_output("fft",seq,logfft,n/2,1,0,0);
+      _analysis_output("fftR",seq,logfft,n/2,1,0,0);
     }
+  }else{
+    _analysis_output("fft",seq,logfft,n/2,1,0,0);
+  }
 #endif
+}
 
-  }
+static void mapping0_transform_job(void *arg,int i){
+  mapping0_state *st=arg;
+  mapping0_transform_channel(st,i,st->work+i*st->vb->pcmend);
+}
 
-  {
-    float   *noise        = _vorbis_block_alloc(vb,n/2*sizeof(*noise));
-    float   *tone         = _vorbis_block_alloc(vb,n/2*sizeof(*tone));
+/* window and transform each channel, and find the block's peak
+   amplitude.  The next block's psychoacoustics depend on that peak, so
+   this phase runs in block order; the encode phase that follows
+   depends only on this block. */
+static int mapping0_transform(vorbis_block *vb){
+  vorbis_dsp_state      *vd=vb->vd;
+  vorbis_info           *vi=vd->vi;
+  codec_setup_info      *ci=vi->codec_setup;
+  private_state         *b=vb->vd->backend_state;
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  int                    n=vb->pcmend;
+  int i;
 
-    for(i=0;i<vi->channels;i++){
-      /* the encoder setup assumes that all the modes used by any
-         specific bitrate tweaking use the same floor */
+  mapping0_state *st  = _vorbis_block_alloc(vb,sizeof(*st));
+  float  **gmdct      = _vorbis_block_alloc(vb,vi->channels*sizeof(*gmdct));
+  float *local_ampmax = _vorbis_block_alloc(vb,vi->channels*sizeof(*local_ampmax));
 
-      int submap=info->chmuxlist[i];
+  float global_ampmax=vbi->ampmax;
+  int blocktype=vbi->blocktype;
 
-      /* the following makes things clearer to *me* anyway */
-      float *mdct    =gmdct[i];
-      float *logfft  =vb->pcm[i];
+  int modenumber=vb->W;
+  vorbis_info_mapping0 *info=ci->map_param[modenumber];
 
-      float *logmdct =logfft+n/2;
-      float *logmask =logfft;
+  vb->mode=modenumber;
 
-      vb->mode=modenumber;
+  memset(st,0,sizeof(*st));
+  st->vb=vb;
+  st->info=info;
+  st->psy_look=b->psy+blocktype+(vb->W?2:0);
+  st->gmdct=gmdct;
+  st->local_ampmax=local_ampmax;
+  st->resend=mapping0_residue_end(vb,info);
 
-      floor_posts[i]=_vorbis_block_alloc(vb,PACKETBLOBS*sizeof(**floor_posts));
-      memset(floor_posts[i],0,sizeof(**floor_posts)*PACKETBLOBS);
+  for(i=0;i<vi->channels;i++)
+    gmdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(**gmdct));
 
-      for(j=0;j<n/2;j++)
-        logmdct[j]=todB(mdct+j)  + .345; /* + .345 is a hack; the original
-                                     todB estimation used on IEEE 754
-                                     compliant machines had a bug that
-                                     returned dB values about a third
-                                     of a decibel too high.  The bug
-                                     was harmless because tunings
-                                     implicitly took that into
-                                     account.  However, fixing the bug
-                                     in the estimator requires
-                                     changing all the tunings as well.
-                                     For now, it's easier to sync
-                                     things back up here, and
-                                     recalibrate the tunings in the
-                                     next major model upgrade. */
+  if(b->pool && !b->pipelined && vi->channels>1){
+    /* channels are independent up to the peak; the FFT lookup's own
+       scratch can't be shared, so give each channel its own */
+    st->work=_vorbis_block_alloc(vb,vi->channels*n*sizeof(*st->work));
+    _vorbis_pool_run(b->pool,mapping0_transform_job,st,vi->channels);
+  }else{
+    for(i=0;i<vi->channels;i++)
+      mapping0_transform_channel(st,i,NULL);
+  }
+
+  for(i=0;i<vi->channels;i++)
+    if(local_ampmax[i]>global_ampmax)global_ampmax=local_ampmax[i];
+
+  st->global_ampmax=global_ampmax;
+  vbi->ampmax=global_ampmax;
+  vbi->mapstate=st;
+  return(0);
+}
+
+/* noise and tone masks and floor fits for one channel.  wb supplies
+   working storage; noise and tone are n/2 floats of scratch */
+static void mapping0_fit_channel(mapping0_state *st,vorbis_block *wb,int i,
+                                 float *noise,float *tone){
+  vorbis_block          *vb=st->vb;
+  private_state         *b=vb->vd->backend_state;
+  vorbis_info_mapping0  *info=st->info;
+  vorbis_look_psy       *psy_look=st->psy_look;
+  int                 ***floor_posts=st->floor_posts;
+  int                    n=vb->pcmend;
+  int                    j,k;
+
+  /* the encoder setup assumes that all the modes used by any
+     specific bitrate tweaking use the same floor */
+
+  int submap=info->chmuxlist[i];
+
+  /* the following makes things clearer to *me* anyway */
+  float *mdct    =st->gmdct[i];
+  float *logfft  =vb->pcm[i];
+
+  float *logmdct =logfft+n/2;
+  float *logmask =logfft;
+
+  /* nothing past the residue's end is coded, so the floor is fit and
+     the masks are needed only up to there */
+  int lowpass=st->resend;
+
+  for(j=0;j<lowpass;j++)
+    logmdct[j]=todB(mdct+j)  + .345; /* + .345 is a hack; the original
+                                 todB estimation used on IEEE 754
+                                 compliant machines had a bug that
+                                 returned dB values about a third
+                                 of a decibel too high.  The bug
+                                 was harmless because tunings
+                                 implicitly took that into
+                                 account.  However, fixing the bug
+                                 in the estimator requires
+                                 changing all the tunings as well.
+                                 For now, it's easier to sync
+                                 things back up here, and
+                                 recalibrate the tunings in the
+                                 next major model upgrade. */
 
 #if 0
-      if(vi->channels==2){
-        if(i==0)
-          _analysis_output("mdctL",seq,logmdct,n/2,1,0,0);
-        else
-          _analysis_output("mdctR",seq,logmdct,n/2,1,0,0);
-      }else{
-        _analysis_output("mdct",seq,logmdct,n/2,1,0,0);
-      }
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("mdctL",seq,logmdct,n/2,1,0,0);
+    else
+      _analysis_output("mdctR",seq,logmdct,n/2,1,0,0);
+  }else{
+    _analysis_output("mdct",seq,logmdct,n/2,1,0,0);
+  }
 #endif
 
-      /* first step; noise masking.  Not only does 'noise masking'
-         give us curves from which we can decide how much resolution
-         to give noise parts of the spectrum, it also implicitly hands
-         us a tonality estimate (the larger the value in the
-         'noise_depth' vector, the more tonal that area is) */
-
-      _vp_noisemask(psy_look,
-                    logmdct,
-                    noise); /* noise does not have by-frequency offset
-                               bias applied yet */
+  /* first step; noise masking.  Not only does 'noise masking'
+     give us curves from which we can decide how much resolution
+     to give noise parts of the spectrum, it also implicitly hands
+     us a tonality estimate (the larger the value in the
+     'noise_depth' vector, the more tonal that area is) */
+
+  _vp_noisemask(psy_look,
+                lowpass,
+                logmdct,
+                noise); /* noise does not have by-frequency offset
+                           bias applied yet */
 #if 0
-      if(vi->channels==2){
-        if(i==0)
-          _analysis_output("noiseL",seq,noise,n/2,1,0,0);
-        else
-          _analysis_output("noiseR",seq,noise,n/2,1,0,0);
-      }else{
-        _analysis_output("noise",seq,noise,n/2,1,0,0);
-      }
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("noiseL",seq,noise,n/2,1,0,0);
+    else
+      _analysis_output("noiseR",seq,noise,n/2,1,0,0);
+  }else{
+    _analysis_output("noise",seq,noise,n/2,1,0,0);
+  }
 #endif
 
-      /* second step: 'all the other crap'; all the stuff that isn't
-         computed/fit for bitrate management goes in the second psy
-         vector.  This includes tone masking, peak limiting and ATH */
+  /* second step: 'all the other crap'; all the stuff that isn't
+     computed/fit for bitrate management goes in the second psy
+     vector.  This includes tone masking, peak limiting and ATH */
 
-      _vp_tonemask(psy_look,
-                   logfft,
-                   tone,
-                   global_ampmax,
-                   local_ampmax[i]);
+  _vp_tonemask(psy_look,
+               lowpass,
+               logfft,
+               tone,
+               st->global_ampmax,
+               st->local_ampmax[i]);
 
 #if 0
-      if(vi->channels==2){
-        if(i==0)
-          _analysis_output("toneL",seq,tone,n/2,1,0,0);
-        else
-          _analysis_output("toneR",seq,tone,n/2,1,0,0);
-      }else{
-        _analysis_output("tone",seq,tone,n/2,1,0,0);
-      }
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("toneL",seq,tone,n/2,1,0,0);
+    else
+      _analysis_output("toneR",seq,tone,n/2,1,0,0);
+  }else{
+    _analysis_output("tone",seq,tone,n/2,1,0,0);
+  }
 #endif
 
-      /* third step; we offset the noise vectors, overlay tone
-         masking.  We then do a floor1-specific line fit.  If we're
-         performing bitrate management, the line fit is performed
-         multiple times for up/down tweakage on demand. */
+  /* third step; we offset the noise vectors, overlay tone
+     masking.  We then do a floor1-specific line fit.  If we're
+     performing bitrate management, the line fit is performed
+     multiple times for up/down tweakage on demand. */
 
 #if 0
-      {
-      float aotuv[psy_look->n];
+  {
+  float aotuv[psy_look->n];
 #endif
 
-        _vp_offset_and_mix(psy_look,
-                           noise,
-                           tone,
-                           1,
-                           logmask,
-                           mdct,
-                           logmdct);
+    _vp_offset_and_mix(psy_look,
+                       lowpass,
+                       noise,
+                       tone,
+                       1,
+                       logmask,
+                       mdct,
+                       logmdct);
 
 #if 0
-        if(vi->channels==2){
-          if(i==0)
-            _analysis_output("aotuvM1_L",seq,aotuv,psy_look->n,1,1,0);
-          else
-            _analysis_output("aotuvM1_R",seq,aotuv,psy_look->n,1,1,0);
-        }else{
-          _analysis_output("aotuvM1",seq,aotuv,psy_look->n,1,1,0);
-        }
-      }
+    if(vi->channels==2){
+      if(i==0)
+        _analysis_output("aotuvM1_L",seq,aotuv,psy_look->n,1,1,0);
+      else
+        _analysis_output("aotuvM1_R",seq,aotuv,psy_look->n,1,1,0);
+    }else{
+      _analysis_output("aotuvM1",seq,aotuv,psy_look->n,1,1,0);
+    }
+  }
 #endif
 
 
 #if 0
-      if(vi->channels==2){
-        if(i==0)
-          _analysis_output("mask1L",seq,logmask,n/2,1,0,0);
-        else
-          _analysis_output("mask1R",seq,logmask,n/2,1,0,0);
-      }else{
-        _analysis_output("mask1",seq,logmask,n/2,1,0,0);
-      }
+  if(vi->channels==2){
+    if(i==0)
+      _analysis_output("mask1L",seq,logmask,n/2,1,0,0);
+    else
+      _analysis_output("mask1R",seq,logmask,n/2,1,0,0);
+  }else{
+    _analysis_output("mask1",seq,logmask,n/2,1,0,0);
+  }
 #endif
 
-      /* this algorithm is hardwired to floor 1 for now; abort out if
-         we're *not* floor1.  This won't happen unless someone has
-         broken the encode setup lib.  Guard it anyway. */
-      if(ci->floor_type[info->floorsubmap[submap]]!=1)return(-1);
-
-      floor_posts[i][PACKETBLOBS/2]=
-        floor1_fit(vb,b->flr[info->floorsubmap[submap]],
-                   logmdct,
-                   logmask);
-
-      /* are we managing bitrate?  If so, perform two more fits for
-         later rate tweaking (fits represent hi/lo) */
-      if(vorbis_bitrate_managed(vb) && floor_posts[i][PACKETBLOBS/2]){
-        /* higher rate by way of lower noise curve */
-
-        _vp_offset_and_mix(psy_look,
-                           noise,
-                           tone,
-                           2,
-                           logmask,
-                           mdct,
-                           logmdct);
+  floor_posts[i][PACKETBLOBS/2]=
+    floor1_fit(wb,b->flr[info->floorsubmap[submap]],
+               logmdct,
+               logmask,
+               lowpass);
+
+  /* are we managing bitrate?  If so, perform two more fits for
+     later rate tweaking (fits represent hi/lo) */
+  if(vorbis_bitrate_managed(vb) && floor_posts[i][PACKETBLOBS/2]){
+    /* higher rate by way of lower noise curve */
+
+    _vp_offset_and_mix(psy_look,
+                       lowpass,
+                       noise,
+                       tone,
+                       2,
+                       logmask,
+                       mdct,
+                       logmdct);
 
 #if 0
-        if(vi->channels==2){
-          if(i==0)
-            _analysis_output("mask2L",seq,logmask,n/2,1,0,0);
-          else
-            _analysis_output("mask2R",seq,logmask,n/2,1,0,0);
-        }else{
-          _analysis_output("mask2",seq,logmask,n/2,1,0,0);
-        }
+    if(vi->channels==2){
+      if(i==0)
+        _analysis_output("mask2L",seq,logmask,n/2,1,0,0);
+      else
+        _analysis_output("mask2R",seq,logmask,n/2,1,0,0);
+    }else{
+      _analysis_output("mask2",seq,logmask,n/2,1,0,0);
+    }
 #endif
 
-        floor_posts[i][PACKETBLOBS-1]=
-          floor1_fit(vb,b->flr[info->floorsubmap[submap]],
-                     logmdct,
-                     logmask);
-
-        /* lower rate by way of higher noise curve */
-        _vp_offset_and_mix(psy_look,
-                           noise,
-                           tone,
-                           0,
-                           logmask,
-                           mdct,
-                           logmdct);
+    floor_posts[i][PACKETBLOBS-1]=
+      floor1_fit(wb,b->flr[info->floorsubmap[submap]],
+                 logmdct,
+                 logmask,
+                 lowpass);
+
+    /* lower rate by way of higher noise curve */
+    _vp_offset_and_mix(psy_look,
+                       lowpass,
+                       noise,
+                       tone,
+                       0,
+                       logmask,
+                       mdct,
+                       logmdct);
 
 #if 0
-        if(vi->channels==2){
-          if(i==0)
-            _analysis_output("mask0L",seq,logmask,n/2,1,0,0);
-          else
-            _analysis_output("mask0R",seq,logmask,n/2,1,0,0);
-        }else{
-          _analysis_output("mask0",seq,logmask,n/2,1,0,0);
-        }
+    if(vi->channels==2){
+      if(i==0)
+        _analysis_output("mask0L",seq,logmask,n/2,1,0,0);
+      else
+        _analysis_output("mask0R",seq,logmask,n/2,1,0,0);
+    }else{
+      _analysis_output("mask0",seq,logmask,n/2,1,0,0);
+    }
 #endif
 
-        floor_posts[i][0]=
-          floor1_fit(vb,b->flr[info->floorsubmap[submap]],
-                     logmdct,
-                     logmask);
-
-        /* we also interpolate a range of intermediate curves for
-           intermediate rates */
-        for(k=1;k<PACKETBLOBS/2;k++)
-          floor_posts[i][k]=
-            floor1_interpolate_fit(vb,b->flr[info->floorsubmap[submap]],
-                                   floor_posts[i][0],
-                                   floor_posts[i][PACKETBLOBS/2],
-                                   k*65536/(PACKETBLOBS/2));
-        for(k=PACKETBLOBS/2+1;k<PACKETBLOBS-1;k++)
-          floor_posts[i][k]=
-            floor1_interpolate_fit(vb,b->flr[info->floorsubmap[submap]],
-                                   floor_posts[i][PACKETBLOBS/2],
-                                   floor_posts[i][PACKETBLOBS-1],
-                                   (k-PACKETBLOBS/2)*65536/(PACKETBLOBS/2));
-      }
+    floor_posts[i][0]=
+      floor1_fit(wb,b->flr[info->floorsubmap[submap]],
+                 logmdct,
+                 logmask,
+                 lowpass);
+
+    /* we also interpolate a range of intermediate curves for
+       intermediate rates */
+    for(k=1;k<PACKETBLOBS/2;k++)
+      floor_posts[i][k]=
+        floor1_interpolate_fit(wb,b->flr[info->floorsubmap[submap]],
+                               floor_posts[i][0],
+                               floor_posts[i][PACKETBLOBS/2],
+                               k*65536/(PACKETBLOBS/2));
+    for(k=PACKETBLOBS/2+1;k<PACKETBLOBS-1;k++)
+      floor_posts[i][k]=
+        floor1_interpolate_fit(wb,b->flr[info->floorsubmap[submap]],
+                               floor_posts[i][PACKETBLOBS/2],
+                               floor_posts[i][PACKETBLOBS-1],
+                               (k-PACKETBLOBS/2)*65536/(PACKETBLOBS/2));
+  }
+}
+
+/* pool job; each channel allocates its fits from its own scratch
+   block */
+static void mapping0_fit_job(void *arg,int i){
+  mapping0_state        *st=arg;
+  vorbis_block          *vb=st->vb;
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  vorbis_block          *wb=vbi->chanblock+i;
+  int                    n=vb->pcmend;
+
+  _vorbis_block_ripcord(wb);
+  wb->lW=vb->lW;
+  wb->W=vb->W;
+  wb->nW=vb->nW;
+  wb->pcmend=vb->pcmend;
+  wb->mode=vb->mode;
+  wb->vd=vb->vd;
+
+  mapping0_fit_channel(st,wb,i,st->work+i*n,st->work+i*n+n/2);
+}
+
+/* fit the floors and encode the packet blobs of a transformed block */
+static int mapping0_encode(vorbis_block *vb){
+  vorbis_dsp_state      *vd=vb->vd;
+  vorbis_info           *vi=vd->vi;
+  codec_setup_info      *ci=vi->codec_setup;
+  private_state         *b=vb->vd->backend_state;
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  mapping0_state        *st=vbi->mapstate;
+  int                    n=vb->pcmend;
+  int i,k;
+
+  int    *nonzero;
+  int    **iwork;
+  int ***floor_posts;
+  vorbis_info_mapping0 *info;
+
+  if(!st)return(-1);
+  info=st->info;
+
+  nonzero     = _vorbis_block_alloc(vb,vi->channels*sizeof(*nonzero));
+  iwork       = _vorbis_block_alloc(vb,vi->channels*sizeof(*iwork));
+  floor_posts = _vorbis_block_alloc(vb,vi->channels*sizeof(*floor_posts));
+  for(i=0;i<vi->channels;i++)
+    iwork[i]=_vorbis_block_alloc(vb,n/2*sizeof(**iwork));
+  st->floor_posts=floor_posts;
+
+  {
+    int threaded=(b->pool && !b->pipelined && vi->channels>1);
+
+    for(i=0;i<vi->channels;i++){
+      floor_posts[i]=_vorbis_block_alloc(vb,PACKETBLOBS*sizeof(**floor_posts));
+      memset(floor_posts[i],0,sizeof(**floor_posts)*PACKETBLOBS);
+
+      /* this algorithm is hardwired to floor 1 for now; abort out if
+         we're *not* floor1.  This won't happen unless someone has
+         broken the encode setup lib.  Guard it anyway. */
+      if(ci->floor_type[info->floorsubmap[info->chmuxlist[i]]]!=1)return(-1);
+    }
+
+    if(threaded && !vbi->chanblock){
+      vbi->chanblock=_ogg_calloc(vi->channels,sizeof(*vbi->chanblock));
+      if(vbi->chanblock)vbi->chanblocks=vi->channels;
+    }
+
+    if(threaded && vbi->chanblock){
+      /* the fits read only their own channel; the floor posts they
+         allocate live in per-channel blocks owned by this block */
+      st->work=_vorbis_block_alloc(vb,vi->channels*n*sizeof(*st->work));
+      _vorbis_pool_run(b->pool,mapping0_fit_job,st,vi->channels);
+    }else{
+      float *noise=_vorbis_block_alloc(vb,n/2*sizeof(*noise));
+      float *tone =_vorbis_block_alloc(vb,n/2*sizeof(*tone));
+      for(i=0;i<vi->channels;i++)
+        mapping0_fit_channel(st,vb,i,noise,tone);
     }
   }
-  vbi->ampmax=global_ampmax;
 
   /*
-    the next phases are performed once for vbr-only and PACKETBLOB
-    times for bitrate managed modes.
+    the next phases are performed once for vbr-only and, for bitrate
+    managed modes, once for each packetblob the bitrate manager
+    examines.
 
     1) encode actual mode being used
     2) encode the floor for each channel, compute coded mask curve/res
@@ -590,102 +927,46 @@ static int mapping0_forward(vorbis_block *vb){
   /* iterate over the many masking curve fits we've created */
 
   {
-    int **couple_bundle=alloca(sizeof(*couple_bundle)*vi->channels);
-    int *zerobundle=alloca(sizeof(*zerobundle)*vi->channels);
-
-    for(k=(vorbis_bitrate_managed(vb)?0:PACKETBLOBS/2);
-        k<=(vorbis_bitrate_managed(vb)?PACKETBLOBS-1:PACKETBLOBS/2);
-        k++){
-      oggpack_buffer *opb=vbi->packetblob[k];
-
-      /* start out our new packet blob with packet type and mode */
-      /* Encode the packet type */
-      oggpack_write(opb,0,1);
-      /* Encode the modenumber */
-      /* Encode frame mode, pre,post windowsize, then dispatch */
-      oggpack_write(opb,modenumber,b->modebits);
-      if(vb->W){
-        oggpack_write(opb,vb->lW,1);
-        oggpack_write(opb,vb->nW,1);
-      }
+    mapping0_state *blobs=st;
+    int lo=PACKETBLOBS/2;
+    int hi=PACKETBLOBS/2;
 
-      /* encode floor, compute masking curve, sep out residue */
-      for(i=0;i<vi->channels;i++){
-        int submap=info->chmuxlist[i];
-        int *ilogmask=iwork[i];
-
-        nonzero[i]=floor1_encode(opb,vb,b->flr[info->floorsubmap[submap]],
-                                 floor_posts[i][k],
-                                 ilogmask);
-#if 0
-        {
-          char buf[80];
-          sprintf(buf,"maskI%c%d",i?'R':'L',k);
-          float work[n/2];
-          for(j=0;j<n/2;j++)
-            work[j]=FLOOR1_fromdB_LOOKUP[iwork[i][j]];
-          _analysis_output(buf,seq,work,n/2,1,1,0);
-        }
-#endif
-      }
-
-      /* our iteration is now based on masking curve, not prequant and
-         coupling.  Only one prequant/coupling step */
-
-      /* quantize/couple */
-      /* incomplete implementation that assumes the tree is all depth
-         one, or no tree at all */
-      _vp_couple_quantize_normalize(k,
-                                    &ci->psy_g_param,
-                                    psy_look,
-                                    info,
-                                    gmdct,
-                                    iwork,
-                                    nonzero,
-                                    ci->psy_g_param.sliding_lowpass[vb->W][k],
-                                    vi->channels);
-
-#if 0
-      for(i=0;i<vi->channels;i++){
-        char buf[80];
-        sprintf(buf,"res%c%d",i?'R':'L',k);
-        float work[n/2];
-        for(j=0;j<n/2;j++)
-          work[j]=iwork[i][j];
-        _analysis_output(buf,seq,work,n/2,1,0,0);
+    for(k=0;k<PACKETBLOBS;k++){
+      blobs->iwork[k]=iwork;
+      blobs->nonzero[k]=nonzero;
+    }
+    memset(vbi->blobready,0,sizeof(vbi->blobready));
+
+    if(vorbis_bitrate_managed(vb)){
+      /* the bitrate manager starts from its running choice and
+         rarely strays far; encode that neighborhood now (as wide as
+         we have threads) and anything else on request */
+      int width=(b->pipelined?1:_vorbis_pool_threads(b->pool));
+      if(width>PACKETBLOBS)width=PACKETBLOBS;
+      lo=vorbis_bitrate_guess(vb)-(width-1)/2;
+      if(lo<0)lo=0;
+      if(lo+width>PACKETBLOBS)lo=PACKETBLOBS-width;
+      hi=lo+width-1;
+    }
+    blobs->lo=lo;
+
+    if(b->pool && !b->pipelined && hi>lo){
+      /* the blobs share only read-only analysis; give each its own
+         quantization vectors and allocation arena so they can be
+         encoded concurrently */
+      for(k=lo;k<=hi;k++){
+        blobs->iwork[k]=_vorbis_block_alloc(vb,vi->channels*sizeof(**blobs->iwork));
+        blobs->nonzero[k]=_vorbis_block_alloc(vb,vi->channels*sizeof(**blobs->nonzero));
+        for(i=0;i<vi->channels;i++)
+          blobs->iwork[k][i]=_vorbis_block_alloc(vb,n/2*sizeof(***blobs->iwork));
       }
-#endif
-
-      /* classify and encode by submap */
-      for(i=0;i<info->submaps;i++){
-        int ch_in_bundle=0;
-        long **classifications;
-        int resnum=info->residuesubmap[i];
-
-        for(j=0;j<vi->channels;j++){
-          if(info->chmuxlist[j]==i){
-            zerobundle[ch_in_bundle]=0;
-            if(nonzero[j])zerobundle[ch_in_bundle]=1;
-            couple_bundle[ch_in_bundle++]=iwork[j];
-          }
-        }
-
-        classifications=_residue_P[ci->residue_type[resnum]]->
-          class(vb,b->residue[resnum],couple_bundle,zerobundle,ch_in_bundle);
-
-        ch_in_bundle=0;
-        for(j=0;j<vi->channels;j++)
-          if(info->chmuxlist[j]==i)
-            couple_bundle[ch_in_bundle++]=iwork[j];
-
-        _residue_P[ci->residue_type[resnum]]->
-          forward(opb,vb,b->residue[resnum],
-                  couple_bundle,zerobundle,ch_in_bundle,classifications,i);
+      _vorbis_pool_run(b->pool,mapping0_blob_job,blobs,hi-lo+1);
+    }else{
+      for(k=lo;k<=hi;k++){
+        mapping0_encode_blob(blobs,vb,k,iwork,nonzero);
+        vbi->blobready[k]=1;
       }
-
-      /* ok, done encoding.  Next protopacket. */
     }
-
   }
 
 #if 0
@@ -695,6 +976,12 @@ static int mapping0_forward(vorbis_block *vb){
   return(0);
 }
 
+static int mapping0_forward(vorbis_block *vb){
+  int ret=mapping0_transform(vb);
+  if(ret)return(ret);
+  return(mapping0_encode(vb));
+}
+
 static int mapping0_inverse(vorbis_block *vb,vorbis_info_mapping *l){
   vorbis_dsp_state     *vd=vb->vd;
   vorbis_info          *vi=vd->vi;
@@ -804,5 +1091,8 @@ const vorbis_func_mapping mapping0_exportbundle={
   &mapping0_unpack,
   &mapping0_free_info,
   &mapping0_forward,
-  &mapping0_inverse
+  &mapping0_inverse,
+  &mapping0_transform,
+  &mapping0_encode,
+  &mapping0_blob
 };
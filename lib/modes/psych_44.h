@@ -23,31 +23,36 @@ static const vorbis_info_psy_global _psy_global_44[5]={
    {20.f,14.f,12.f,12.f,12.f,12.f,12.f},
    {-60.f,-30.f,-40.f,-40.f,-40.f,-40.f,-40.f}, 2,-75.f,
    -6.f,
-   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}}
+   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}},
+   0,0
   },
   {8,   /* lines per eighth octave */
    {14.f,10.f,10.f,10.f,10.f,10.f,10.f},
    {-40.f,-30.f,-25.f,-25.f,-25.f,-25.f,-25.f}, 2,-80.f,
    -6.f,
-   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}}
+   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}},
+   0,0
   },
   {8,   /* lines per eighth octave */
    {12.f,10.f,10.f,10.f,10.f,10.f,10.f},
    {-20.f,-20.f,-15.f,-15.f,-15.f,-15.f,-15.f}, 0,-80.f,
    -6.f,
-   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}}
+   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}},
+   0,0
   },
   {8,   /* lines per eighth octave */
    {10.f,8.f,8.f,8.f,8.f,8.f,8.f},
    {-20.f,-15.f,-12.f,-12.f,-12.f,-12.f,-12.f}, 0,-80.f,
    -6.f,
-   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}}
+   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}},
+   0,0
   },
   {8,   /* lines per eighth octave */
    {10.f,6.f,6.f,6.f,6.f,6.f,6.f},
    {-15.f,-15.f,-12.f,-12.f,-12.f,-12.f,-12.f}, 0,-85.f,
    -6.f,
-   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}}
+   {99.},{{99.},{99.}},{0},{0},{{0.},{0.}},
+   0,0
   },
 };
 
@@ -27,6 +27,7 @@
 #include "smallft.h"
 #include "scales.h"
 #include "misc.h"
+#include "cache.h"
 
 #define NEGINF -9999.f
 static const double stereo_threshholds[]={0.0, .5, 1.0, 1.5, 2.5, 4.5, 8.5, 16.5, 9e10};
@@ -82,7 +83,7 @@ static void attenuate_curve(float *c,float att){
     c[i]+=att;
 }
 
-static float ***setup_tone_curves(float curveatt_dB[P_BANDS],float binHz,int n,
+static float ***setup_tone_curves(const float curveatt_dB[P_BANDS],float binHz,int n,
                                   float center_boost, float center_decay_rate){
   int i,j,k,m;
   float ath[EHMER_MAX];
@@ -263,23 +264,43 @@ static float ***setup_tone_curves(float curveatt_dB[P_BANDS],float binHz,int n,
   return(ret);
 }
 
-void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
-                  vorbis_info_psy_global *gi,int n,long rate){
+/* the settings the lookup tables are built from.  Streams with equal
+   keys share one copy of the tables through the cache, which compares
+   keys byte for byte; _vp_psy_init zeroes the key before filling it
+   in, so any padding compares equal as well. */
+typedef struct {
+  float toneatt[P_BANDS];
+  float tone_centerboost;
+  float tone_decay;
+  float noiseoff[P_NOISECURVES][P_BANDS];
+  float noisewindowlo;
+  float noisewindowhi;
+  int   noisewindowlomin;
+  int   noisewindowhimin;
+  int   eighth_octave_lines;
+  int   n;
+  long  rate;
+} psy_key;
+
+/* fills in everything but vi */
+static void psy_init_tables(vorbis_look_psy *p,const psy_key *k){
+  int eighth_octave_lines=k->eighth_octave_lines;
+  int n=k->n;
+  long rate=k->rate;
   long i,j,lo=-99,hi=1;
   long maxoc;
   memset(p,0,sizeof(*p));
 
-  p->eighth_octave_lines=gi->eighth_octave_lines;
-  p->shiftoc=rint(log(gi->eighth_octave_lines*8.f)/log(2.f))-1;
+  p->eighth_octave_lines=eighth_octave_lines;
+  p->shiftoc=rint(log(eighth_octave_lines*8.f)/log(2.f))-1;
 
-  p->firstoc=toOC(.25f*rate*.5/n)*(1<<(p->shiftoc+1))-gi->eighth_octave_lines;
+  p->firstoc=toOC(.25f*rate*.5/n)*(1<<(p->shiftoc+1))-eighth_octave_lines;
   maxoc=toOC((n+.25f)*rate*.5/n)*(1<<(p->shiftoc+1))+.5f;
   p->total_octave_lines=maxoc-p->firstoc+1;
   p->ath=_ogg_malloc(n*sizeof(*p->ath));
 
   p->octave=_ogg_malloc(n*sizeof(*p->octave));
   p->bark=_ogg_malloc(n*sizeof(*p->bark));
-  p->vi=vi;
   p->n=n;
   p->rate=rate;
 
@@ -310,11 +331,11 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
   for(i=0;i<n;i++){
     float bark=toBARK(rate/(2*n)*i);
 
-    for(;lo+vi->noisewindowlomin<i &&
-          toBARK(rate/(2*n)*lo)<(bark-vi->noisewindowlo);lo++);
+    for(;lo+k->noisewindowlomin<i &&
+          toBARK(rate/(2*n)*lo)<(bark-k->noisewindowlo);lo++);
 
-    for(;hi<=n && (hi<i+vi->noisewindowhimin ||
-          toBARK(rate/(2*n)*hi)<(bark+vi->noisewindowhi));hi++);
+    for(;hi<=n && (hi<i+k->noisewindowhimin ||
+          toBARK(rate/(2*n)*hi)<(bark+k->noisewindowhi));hi++);
 
     p->bark[i]=((lo-1)<<16)+(hi-1);
 
@@ -323,8 +344,8 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
   for(i=0;i<n;i++)
     p->octave[i]=toOC((i+.25f)*.5*rate/n)*(1<<(p->shiftoc+1))+.5f;
 
-  p->tonecurves=setup_tone_curves(vi->toneatt,rate*.5/n,n,
-                                  vi->tone_centerboost,vi->tone_decay);
+  p->tonecurves=setup_tone_curves(k->toneatt,rate*.5/n,n,
+                                  k->tone_centerboost,k->tone_decay);
 
   /* set up rolling noise median */
   p->noiseoffset=_ogg_malloc(P_NOISECURVES*sizeof(*p->noiseoffset));
@@ -343,8 +364,8 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
 
     for(j=0;j<P_NOISECURVES;j++)
       p->noiseoffset[j][i]=
-        p->vi->noiseoff[j][inthalfoc]*(1.-del) +
-        p->vi->noiseoff[j][inthalfoc+1]*del;
+        k->noiseoff[j][inthalfoc]*(1.-del) +
+        k->noiseoff[j][inthalfoc+1]*del;
 
   }
 #if 0
@@ -357,7 +378,7 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
 #endif
 }
 
-void _vp_psy_clear(vorbis_look_psy *p){
+static void psy_free_tables(vorbis_look_psy *p){
   int i,j;
   if(p){
     if(p->ath)_ogg_free(p->ath);
@@ -382,6 +403,56 @@ void _vp_psy_clear(vorbis_look_psy *p){
   }
 }
 
+static void *psy_build(void *key){
+  vorbis_look_psy *p=_ogg_malloc(sizeof(*p));
+  if(p)psy_init_tables(p,key);
+  return p;
+}
+
+static void psy_destroy(void *p){
+  psy_free_tables(p);
+  _ogg_free(p);
+}
+
+void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
+                  vorbis_info_psy_global *gi,int n,long rate){
+  vorbis_look_psy *shared;
+  psy_key key;
+
+  memset(&key,0,sizeof(key));
+  memcpy(key.toneatt,vi->toneatt,sizeof(key.toneatt));
+  key.tone_centerboost=vi->tone_centerboost;
+  key.tone_decay=vi->tone_decay;
+  memcpy(key.noiseoff,vi->noiseoff,sizeof(key.noiseoff));
+  key.noisewindowlo=vi->noisewindowlo;
+  key.noisewindowhi=vi->noisewindowhi;
+  key.noisewindowlomin=vi->noisewindowlomin;
+  key.noisewindowhimin=vi->noisewindowhimin;
+  key.eighth_octave_lines=gi->eighth_octave_lines;
+  key.n=n;
+  key.rate=rate;
+
+  /* the shared copy has no vi; each stream points at its own */
+  shared=_vorbis_cache_get(VC_PSY,&key,sizeof(key),psy_build,&key,
+                           psy_destroy);
+  if(shared){
+    *p=*shared;
+    p->shared=shared;
+  }else
+    psy_init_tables(p,&key);
+  p->vi=vi;
+}
+
+void _vp_psy_clear(vorbis_look_psy *p){
+  if(p){
+    if(p->shared)
+      _vorbis_cache_release(p->shared);
+    else
+      psy_free_tables(p);
+    memset(p,0,sizeof(*p));
+  }
+}
+
 /* octave/(8*eighth_octave_lines) x scale and dB y scale */
 static void seed_curve(float *seed,
                        const float **curves,
@@ -399,25 +470,31 @@ static void seed_curve(float *seed,
   curve=posts+2;
   post1=(int)posts[1];
   seedptr=oc+(posts[0]-EHMER_OFFSET)*linesper-(linesper>>1);
+  i=posts[0];
+
+  /* clip the curve to the seed vector up front so the loop below is
+     a plain strided max */
+  if(seedptr<=0){
+    int skip=-seedptr/linesper+1;
+    i+=skip;
+    seedptr+=skip*linesper;
+  }
 
-  for(i=posts[0];i<post1;i++){
-    if(seedptr>0){
-      float lin=amp+curve[i];
-      if(seed[seedptr]<lin)seed[seedptr]=lin;
-    }
-    seedptr+=linesper;
-    if(seedptr>=n)break;
+  for(;i<post1 && seedptr<n;i++,seedptr+=linesper){
+    float lin=amp+curve[i];
+    float old=seed[seedptr];
+    seed[seedptr]=(old<lin?lin:old);
   }
 }
 
-static void seed_loop(vorbis_look_psy *p,
+static void seed_loop(vorbis_look_psy *p,long n,
                       const float ***curves,
                       const float *f,
                       const float *flr,
                       float *seed,
                       float specmax){
   vorbis_info_psy *vi=p->vi;
-  long n=p->n,i;
+  long i;
   float dBoffset=vi->max_curve_dB-specmax;
 
   /* prime the working vector with peak values */
@@ -505,7 +582,7 @@ static void seed_chase(float *seeds, int linesper, long n){
 
 /* bleaugh, this is more complicated than it needs to be */
 #include<stdio.h>
-static void max_seeds(vorbis_look_psy *p,
+static void max_seeds(vorbis_look_psy *p,long lowpass,
                       float *seed,
                       float *flr){
   long   n=p->total_octave_lines;
@@ -517,7 +594,7 @@ static void max_seeds(vorbis_look_psy *p,
 
   pos=p->octave[0]-p->firstoc-(linesper>>1);
 
-  while(linpos+1<p->n){
+  while(linpos+1<lowpass){
     float minV=seed[pos];
     long end=((p->octave[linpos]+p->octave[linpos+1])>>1)-p->firstoc;
     if(minV>p->vi->tone_abs_limit)minV=p->vi->tone_abs_limit;
@@ -528,18 +605,59 @@ static void max_seeds(vorbis_look_psy *p,
     }
 
     end=pos+p->firstoc;
-    for(;linpos<p->n && p->octave[linpos]<=end;linpos++)
+    for(;linpos<lowpass && p->octave[linpos]<=end;linpos++)
       if(flr[linpos]<minV)flr[linpos]=minV;
   }
 
   {
     float minV=seed[p->total_octave_lines-1];
-    for(;linpos<p->n;linpos++)
+    for(;linpos<lowpass;linpos++)
       if(flr[linpos]<minV)flr[linpos]=minV;
   }
 
 }
 
+/* The regressions of one pass, given each bin's window sums.  Bins
+   are independent and the loop has no branches left, so it
+   vectorizes.  Returns the last bin's terms in A/B/D, which the caller
+   extends past the end of the windows. */
+static void bark_noise_regress(int n,const float *tN,const float *tX,
+                               const float *tXX,const float *tY,
+                               const float *tXY,float *noise,
+                               const float offset,const int fixed,
+                               float *A,float *B,float *D){
+  int i;
+  float a, b, d, R;
+
+  if(fixed<=0){
+    for (i = 0; i < n; i++) {
+      a = tY[i] * tXX[i] - tX[i] * tXY[i];
+      b = tN[i] * tXY[i] - tX[i] * tY[i];
+      d = tN[i] * tXX[i] - tX[i] * tX[i];
+      R = (a + (float)i * b) / d;
+      if (R < 0.f) R = 0.f;
+
+      noise[i] = R - offset;
+    }
+  }else{
+    for (i = 0; i < n; i++) {
+      a = tY[i] * tXX[i] - tX[i] * tXY[i];
+      b = tN[i] * tXY[i] - tX[i] * tY[i];
+      d = tN[i] * tXX[i] - tX[i] * tX[i];
+      R = (a + (float)i * b) / d - offset;
+
+      noise[i] = (R < noise[i] ? R : noise[i]);
+    }
+  }
+
+  if(n>0){
+    i=n-1;
+    *A = tY[i] * tXX[i] - tX[i] * tXY[i];
+    *B = tN[i] * tXY[i] - tX[i] * tY[i];
+    *D = tN[i] * tXX[i] - tX[i] * tX[i];
+  }
+}
+
 static void bark_noise_hybridmp(int n,const long *b,
                                 const float *f,
                                 float *noise,
@@ -552,6 +670,13 @@ static void bark_noise_hybridmp(int n,const long *b,
   float *Y=alloca(n*sizeof(*N));
   float *XY=alloca(n*sizeof(*N));
 
+  /* per bin window sums, gathered ahead of the regression */
+  float *sN=alloca(n*sizeof(*N));
+  float *sX=alloca(n*sizeof(*N));
+  float *sXX=alloca(n*sizeof(*N));
+  float *sY=alloca(n*sizeof(*N));
+  float *sXY=alloca(n*sizeof(*N));
+
   float tN, tX, tXX, tY, tXY;
   int i;
 
@@ -599,51 +724,37 @@ static void bark_noise_hybridmp(int n,const long *b,
     XY[i] = tXY;
   }
 
-  for (i = 0, x = 0.f; i < n; i++, x += 1.f) {
+  for (i = 0; i < n; i++) {
 
     lo = b[i] >> 16;
     hi = b[i] & 0xffff;
     if( lo>=0 || -lo>=n ) break;
     if( hi>=n ) break;
 
-    tN = N[hi] + N[-lo];
-    tX = X[hi] - X[-lo];
-    tXX = XX[hi] + XX[-lo];
-    tY = Y[hi] + Y[-lo];
-    tXY = XY[hi] - XY[-lo];
-
-    A = tY * tXX - tX * tXY;
-    B = tN * tXY - tX * tY;
-    D = tN * tXX - tX * tX;
-    R = (A + x * B) / D;
-    if (R < 0.f) R = 0.f;
-
-    noise[i] = R - offset;
+    sN[i] = N[hi] + N[-lo];
+    sX[i] = X[hi] - X[-lo];
+    sXX[i] = XX[hi] + XX[-lo];
+    sY[i] = Y[hi] + Y[-lo];
+    sXY[i] = XY[hi] - XY[-lo];
   }
 
-  for ( ; i < n; i++, x += 1.f) {
+  for ( ; i < n; i++) {
 
     lo = b[i] >> 16;
     hi = b[i] & 0xffff;
     if( lo<0 || lo>=n ) break;
     if( hi>=n ) break;
 
-    tN = N[hi] - N[lo];
-    tX = X[hi] - X[lo];
-    tXX = XX[hi] - XX[lo];
-    tY = Y[hi] - Y[lo];
-    tXY = XY[hi] - XY[lo];
-
-    A = tY * tXX - tX * tXY;
-    B = tN * tXY - tX * tY;
-    D = tN * tXX - tX * tX;
-    R = (A + x * B) / D;
-    if (R < 0.f) R = 0.f;
-
-    noise[i] = R - offset;
+    sN[i] = N[hi] - N[lo];
+    sX[i] = X[hi] - X[lo];
+    sXX[i] = XX[hi] - XX[lo];
+    sY[i] = Y[hi] - Y[lo];
+    sXY[i] = XY[hi] - XY[lo];
   }
 
-  for ( ; i < n; i++, x += 1.f) {
+  bark_noise_regress(i,sN,sX,sXX,sY,sXY,noise,offset,0,&A,&B,&D);
+
+  for (x = (float)i; i < n; i++, x += 1.f) {
 
     R = (A + x * B) / D;
     if (R < 0.f) R = 0.f;
@@ -653,59 +764,50 @@ static void bark_noise_hybridmp(int n,const long *b,
 
   if (fixed <= 0) return;
 
-  for (i = 0, x = 0.f; i < n; i++, x += 1.f) {
+  for (i = 0; i < n; i++) {
     hi = i + fixed / 2;
     lo = hi - fixed;
     if ( hi>=n ) break;
     if ( lo>=0 ) break;
 
-    tN = N[hi] + N[-lo];
-    tX = X[hi] - X[-lo];
-    tXX = XX[hi] + XX[-lo];
-    tY = Y[hi] + Y[-lo];
-    tXY = XY[hi] - XY[-lo];
-
-
-    A = tY * tXX - tX * tXY;
-    B = tN * tXY - tX * tY;
-    D = tN * tXX - tX * tX;
-    R = (A + x * B) / D;
-
-    if (R - offset < noise[i]) noise[i] = R - offset;
+    sN[i] = N[hi] + N[-lo];
+    sX[i] = X[hi] - X[-lo];
+    sXX[i] = XX[hi] + XX[-lo];
+    sY[i] = Y[hi] + Y[-lo];
+    sXY[i] = XY[hi] - XY[-lo];
   }
-  for ( ; i < n; i++, x += 1.f) {
+  for ( ; i < n; i++) {
 
     hi = i + fixed / 2;
     lo = hi - fixed;
     if ( hi>=n ) break;
     if ( lo<0 ) break;
 
-    tN = N[hi] - N[lo];
-    tX = X[hi] - X[lo];
-    tXX = XX[hi] - XX[lo];
-    tY = Y[hi] - Y[lo];
-    tXY = XY[hi] - XY[lo];
+    sN[i] = N[hi] - N[lo];
+    sX[i] = X[hi] - X[lo];
+    sXX[i] = XX[hi] - XX[lo];
+    sY[i] = Y[hi] - Y[lo];
+    sXY[i] = XY[hi] - XY[lo];
+  }
 
-    A = tY * tXX - tX * tXY;
-    B = tN * tXY - tX * tY;
-    D = tN * tXX - tX * tX;
-    R = (A + x * B) / D;
+  bark_noise_regress(i,sN,sX,sXX,sY,sXY,noise,offset,fixed,&A,&B,&D);
 
-    if (R - offset < noise[i]) noise[i] = R - offset;
-  }
-  for ( ; i < n; i++, x += 1.f) {
+  for (x = (float)i; i < n; i++, x += 1.f) {
     R = (A + x * B) / D;
     if (R - offset < noise[i]) noise[i] = R - offset;
   }
 }
 
 void _vp_noisemask(vorbis_look_psy *p,
+                   int lowpass,
                    float *logmdct,
                    float *logmask){
 
-  int i,n=p->n;
+  int i,n=lowpass;
   float *work=alloca(n*sizeof(*work));
 
+  if(n<=0)return;
+
   bark_noise_hybridmp(n,p->bark,logmdct,logmask,
                       140.,-1);
 
@@ -748,12 +850,13 @@ void _vp_noisemask(vorbis_look_psy *p,
 }
 
 void _vp_tonemask(vorbis_look_psy *p,
+                  int lowpass,
                   float *logfft,
                   float *logmask,
                   float global_specmax,
                   float local_specmax){
 
-  int i,n=p->n;
+  int i,n=lowpass;
 
   float *seed=alloca(sizeof(*seed)*p->total_octave_lines);
   float att=local_specmax+p->vi->ath_adjatt;
@@ -767,19 +870,20 @@ void _vp_tonemask(vorbis_look_psy *p,
     logmask[i]=p->ath[i]+att;
 
   /* tone masking */
-  seed_loop(p,(const float ***)p->tonecurves,logfft,logmask,seed,global_specmax);
-  max_seeds(p,seed,logmask);
+  seed_loop(p,n,(const float ***)p->tonecurves,logfft,logmask,seed,global_specmax);
+  max_seeds(p,n,seed,logmask);
 
 }
 
 void _vp_offset_and_mix(vorbis_look_psy *p,
+                        int lowpass,
                         float *noise,
                         float *tone,
                         int offset_select,
                         float *logmask,
                         float *mdct,
                         float *logmdct){
-  int i,n=p->n;
+  int i,n=lowpass;
   float de, coeffi, cx;/* AoTuV */
   float toneatt=p->vi->tone_masteratt[offset_select];
 
@@ -911,12 +1015,6 @@ static float FLOOR1_fromdB_LOOKUP[256]={
 };
 
 /* this is for per-channel noise normalization */
-static int apsort(const void *a, const void *b){
-  float f1=**(float**)a;
-  float f2=**(float**)b;
-  return (f1<f2)-(f1>f2);
-}
-
 static void flag_lossless(int limit, float prepoint, float postpoint, float *mdct,
                          float *floor, int *flag, int i, int jn){
   int j;
@@ -987,18 +1085,41 @@ static float noise_normalize(vorbis_look_psy *p, int limit, float *r, float *q,
   }
 
   if(count){
-    /* noise norm to do */
-    qsort(sort,count,sizeof(*sort),apsort);
+    /* noise norm to do.  acc only falls as elements are promoted, so
+       the promotions go to the largest few magnitudes; count them and
+       select just those rather than sorting the lot.  Ties go to the
+       lower bin, as with a stable sort. */
+    float **top;
+    int promote=0;
+    while(promote<count && acc>=vi->normal_thresh){
+      acc-=1.f;
+      promote++;
+    }
+
+    top=alloca((promote?promote:1)*sizeof(*top));
+    for(j=0;j<count && promote;j++){
+      float *c=sort[j];
+      int m=(j<promote?j:promote);
+      if(m==promote){
+        if(!(*c>*top[m-1]))continue;
+        m--;
+      }
+      while(m>0 && *top[m-1]<*c){
+        top[m]=top[m-1];
+        m--;
+      }
+      top[m]=c;
+    }
+
     for(j=0;j<count;j++){
       int k=sort[j]-q;
-      if(acc>=vi->normal_thresh){
-        out[k]=unitnorm(r[k]);
-        acc-=1.f;
-        q[k]=f[k];
-      }else{
-        out[k]=0;
-        q[k]=0.f;
-      }
+      out[k]=0;
+      q[k]=0.f;
+    }
+    for(j=0;j<promote;j++){
+      int k=top[j]-q;
+      out[k]=unitnorm(r[k]);
+      q[k]=f[k];
     }
   }
 
@@ -1015,11 +1136,15 @@ void _vp_couple_quantize_normalize(int blobno,
                                    int   **iwork,
                                    int    *nonzero,
                                    int     sliding_lowpass,
+                                   int     lowpass,
                                    int     ch){
 
   int i;
   int n = p->n;
   int partition=(p->vi->normal_p ? p->vi->normal_partition : 16);
+  /* nothing past the residue's end is coded; stop at the partition
+     holding it so the partitions quantized are unchanged */
+  int end = (lowpass+partition-1)/partition*partition;
   int limit = g->coupling_pointlimit[p->vi->blockflag][blobno];
   float prepoint=stereo_threshholds[g->coupling_prepointamp[blobno]];
   float postpoint=stereo_threshholds[g->coupling_postpointamp[blobno]];
@@ -1066,7 +1191,11 @@ void _vp_couple_quantize_normalize(int blobno,
   for(i=0;i<ch+vi->coupling_steps;i++)
     acc[i]=0.f;
 
-  for(i=0;i<n;i+=partition){
+  if(end>n)end=n;
+  for(i=0;i<ch;i++)
+    memset(iwork[i]+end,0,(n-end)*sizeof(**iwork));
+
+  for(i=0;i<end;i+=partition){
     int k,j,jn = partition > n-i ? n-i : partition;
     int step,track = 0;
 
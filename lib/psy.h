@@ -80,6 +80,10 @@ typedef struct{
   int   coupling_postpointamp[PACKETBLOBS];
   int   sliding_lowpass[2][PACKETBLOBS];
 
+  /* speed/quality tradeoffs (OV_ECTL_SPEED_SET); encode only */
+  int   mdct_tonemask;   /* estimate tones from the MDCT, not an FFT */
+  int   fixed_blocksize; /* no envelope search; 1: short only, 2: long only */
+
 } vorbis_info_psy_global;
 
 typedef struct {
@@ -110,6 +114,8 @@ typedef struct {
 
   float m_val; /* Masking compensation value */
 
+  void *shared; /* cache entry owning the tables above, if any */
+
 } vorbis_look_psy;
 
 extern void   _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
@@ -121,16 +127,19 @@ extern void   _vi_psy_free(vorbis_info_psy *i);
 extern vorbis_info_psy *_vi_psy_copy(vorbis_info_psy *i);
 
 extern void _vp_noisemask(vorbis_look_psy *p,
+                          int lowpass,
                           float *logmdct,
                           float *logmask);
 
 extern void _vp_tonemask(vorbis_look_psy *p,
+                         int lowpass,
                          float *logfft,
                          float *logmask,
                          float global_specmax,
                          float local_specmax);
 
 extern void _vp_offset_and_mix(vorbis_look_psy *p,
+                               int lowpass,
                                float *noise,
                                float *tone,
                                int offset_select,
@@ -148,6 +157,7 @@ extern void _vp_couple_quantize_normalize(int blobno,
                                           int   **iwork,
                                           int    *nonzero,
                                           int     sliding_lowpass,
+                                          int     lowpass,
                                           int     ch);
 
 #endif
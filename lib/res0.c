@@ -341,31 +341,57 @@ static int local_book_besterror(codebook *book,int *a){
   }
 
   if(book->c->lengthlist[index]<=0){
-    const static_codebook *c=book->c;
-    int best=-1;
-    /* assumes integer/centered encoder codebook maptype 1 no more than dim 8 */
-    int e[8]={0,0,0,0,0,0,0,0};
-    int maxval = book->minval + book->delta*(book->quantvals-1);
-    for(i=0;i<book->entries;i++){
-      if(c->lengthlist[i]>0){
+    if(book->enc_populated){
+      /* only the populated entries can win.  Start from the one
+         nearest our lattice point, which usually is the answer, and
+         abandon any candidate as soon as it's further away; ties go to
+         the lower entry number, as in the full search below */
+      const int *v=book->enc_value+book->enc_seed[index]*dim;
+      int best=0,slot=book->enc_seed[index];
+      for(j=0;j<dim;j++){
+        int val=(v[j]-a[j]);
+        best+=val*val;
+      }
+      for(i=0,v=book->enc_value;i<book->enc_populated;i++,v+=dim){
         int this=0;
-        for(j=0;j<dim;j++){
-          int val=(e[j]-a[j]);
+        for(j=0;j<dim && this<=best;j++){
+          int val=(v[j]-a[j]);
           this+=val*val;
         }
-        if(best==-1 || this<best){
-          memcpy(p,e,sizeof(p));
+        if(this<best || (this==best && i<slot)){
           best=this;
-          index=i;
+          slot=i;
+        }
+      }
+      index=book->enc_entry[slot];
+      memcpy(p,book->enc_value+slot*dim,dim*sizeof(*p));
+    }else{
+      const static_codebook *c=book->c;
+      int best=-1;
+      /* assumes integer/centered encoder codebook maptype 1 no more than dim 8 */
+      int e[8]={0,0,0,0,0,0,0,0};
+      int maxval = book->minval + book->delta*(book->quantvals-1);
+      for(i=0;i<book->entries;i++){
+        if(c->lengthlist[i]>0){
+          int this=0;
+          for(j=0;j<dim;j++){
+            int val=(e[j]-a[j]);
+            this+=val*val;
+          }
+          if(best==-1 || this<best){
+            memcpy(p,e,sizeof(p));
+            best=this;
+            index=i;
+          }
         }
+        /* assumes the value patterning created by the tools in vq/ */
+        j=0;
+        while(e[j]>=maxval)
+          e[j++]=0;
+        if(e[j]>=0)
+          e[j]+=book->delta;
+        e[j]= -e[j];
       }
-      /* assumes the value patterning created by the tools in vq/ */
-      j=0;
-      while(e[j]>=maxval)
-        e[j++]=0;
-      if(e[j]>=0)
-        e[j]+=book->delta;
-      e[j]= -e[j];
     }
   }
 
@@ -378,10 +404,10 @@ static int local_book_besterror(codebook *book,int *a){
 }
 
 #ifdef TRAIN_RES
-static int _encodepart(oggpack_buffer *opb,int *vec, int n,
+static int _encodepart(codeword_writer *w,int *vec, int n,
                        codebook *book,long *acc){
 #else
-static int _encodepart(oggpack_buffer *opb,int *vec, int n,
+static int _encodepart(codeword_writer *w,int *vec, int n,
                        codebook *book){
 #endif
   int i,bits=0;
@@ -396,7 +422,7 @@ static int _encodepart(oggpack_buffer *opb,int *vec, int n,
       acc[entry]++;
 #endif
 
-    bits+=vorbis_book_encode(book,entry,opb);
+    bits+=vorbis_book_encodew(book,entry,w);
 
   }
 
@@ -462,7 +488,9 @@ static long **_01class(vorbis_block *vb,vorbis_look_residue *vl,
     }
   }
 #endif
+#ifdef TRAIN_RES
   look->frames++;
+#endif
 
   return(partword);
 }
@@ -495,12 +523,36 @@ static long **_2class(vorbis_block *vb,vorbis_look_residue *vl,int **in,
   for(i=0,l=info->begin/ch;i<partvals;i++){
     int magmax=0;
     int angmax=0;
-    for(j=0;j<samples_per_partition;j+=ch){
-      if(abs(in[0][l])>magmax)magmax=abs(in[0][l]);
-      for(k=1;k<ch;k++)
-        if(abs(in[k][l])>angmax)angmax=abs(in[k][l]);
-      l++;
+    int len=(samples_per_partition+ch-1)/ch;
+
+    /* each partition covers len values of every channel; maximum
+       magnitude of the first channel and of all the others.  Channel
+       0 is read once, alongside channel 1 so that both running maxima
+       advance in the same loop; further channels add to angmax alone */
+    if(ch>1){
+      const int *mag=in[0]+l;
+      const int *ang=in[1]+l;
+      for(j=0;j<len;j++){
+        int vm=abs(mag[j]);
+        int va=abs(ang[j]);
+        if(vm>magmax)magmax=vm;
+        if(va>angmax)angmax=va;
+      }
+    }else{
+      const int *mag=in[0]+l;
+      for(j=0;j<len;j++){
+        int vm=abs(mag[j]);
+        if(vm>magmax)magmax=vm;
+      }
     }
+    for(k=2;k<ch;k++){
+      const int *ang=in[k]+l;
+      for(j=0;j<len;j++){
+        int va=abs(ang[j]);
+        if(va>angmax)angmax=va;
+      }
+    }
+    l+=len;
 
     for(j=0;j<possible_partitions-1;j++)
       if(magmax<=info->classmetric1[j] &&
@@ -520,7 +572,9 @@ static long **_2class(vorbis_block *vb,vorbis_look_residue *vl,int **in,
   fclose(of);
 #endif
 
+#ifdef TRAIN_RES
   look->frames++;
+#endif
 
   return(partword);
 }
@@ -530,17 +584,18 @@ static int _01forward(oggpack_buffer *opb,
                       int **in,int ch,
                       long **partword,
 #ifdef TRAIN_RES
-                      int (*encode)(oggpack_buffer *,int *,int,
+                      int (*encode)(codeword_writer *,int *,int,
                                     codebook *,long *),
                       int submap
 #else
-                      int (*encode)(oggpack_buffer *,int *,int,
+                      int (*encode)(codeword_writer *,int *,int,
                                     codebook *)
 #endif
 ){
   long i,j,k,s;
   vorbis_look_residue0 *look=(vorbis_look_residue0 *)vl;
   vorbis_info_residue0 *info=look->info;
+  codeword_writer w;
 
 #ifdef TRAIN_RES
   look->submap=submap;
@@ -566,6 +621,7 @@ static int _01forward(oggpack_buffer *opb,
 
   memset(resbits,0,sizeof(resbits));
   memset(resvals,0,sizeof(resvals));
+  vorbis_writer_init(&w,opb);
 
   /* we code the partition words for each channel, then the residual
      words for a partition per channel until we've written all the
@@ -587,8 +643,13 @@ static int _01forward(oggpack_buffer *opb,
           }
 
           /* training hack */
-          if(val<look->phrasebook->entries)
-            look->phrasebits+=vorbis_book_encode(look->phrasebook,val,opb);
+          if(val<look->phrasebook->entries){
+#ifdef TRAIN_RES
+            look->phrasebits+=vorbis_book_encodew(look->phrasebook,val,&w);
+#else
+            vorbis_book_encodew(look->phrasebook,val,&w);
+#endif
+          }
 #if 0 /*def TRAIN_RES*/
           else
             fprintf(stderr,"!");
@@ -620,14 +681,16 @@ static int _01forward(oggpack_buffer *opb,
                     look->training_max[s][partword[j][i]]=samples[l];
                 }
               }
-              ret=encode(opb,in[j]+offset,samples_per_partition,
+              ret=encode(&w,in[j]+offset,samples_per_partition,
                          statebook,accumulator);
 #else
-              ret=encode(opb,in[j]+offset,samples_per_partition,
+              ret=encode(&w,in[j]+offset,samples_per_partition,
                          statebook);
 #endif
 
+#ifdef TRAIN_RES
               look->postbits+=ret;
+#endif
               resbits[partword[j][i]]+=ret;
             }
           }
@@ -636,6 +699,7 @@ static int _01forward(oggpack_buffer *opb,
     }
   }
 
+  vorbis_writer_flush(&w);
   return(0);
 }
 
@@ -24,6 +24,7 @@
 #include "vorbis/codec.h"
 #include "codebook.h"
 #include "scales.h"
+#include "cache.h"
 
 /**** pack/unpack helpers ******************************************/
 
@@ -284,9 +285,20 @@ void vorbis_staticbook_destroy(static_codebook *b){
 void vorbis_book_clear(codebook *b){
   /* static book is not cleared; we're likely called on the lookup and
      the static codebook belongs to the info struct */
+  if(b->enc_shared){
+    _vorbis_cache_release(b->enc_shared);
+    memset(b,0,sizeof(*b));
+    return;
+  }
   if(b->valuelist)_ogg_free(b->valuelist);
   if(b->codelist)_ogg_free(b->codelist);
 
+  if(b->dec_qlist)_ogg_free(b->dec_qlist);
+
+  if(b->enc_entry)_ogg_free(b->enc_entry);
+  if(b->enc_value)_ogg_free(b->enc_value);
+  if(b->enc_seed)_ogg_free(b->enc_seed);
+
   if(b->dec_index)_ogg_free(b->dec_index);
   if(b->dec_codelengths)_ogg_free(b->dec_codelengths);
   if(b->dec_firsttable)_ogg_free(b->dec_firsttable);
@@ -294,7 +306,69 @@ void vorbis_book_clear(codebook *b){
   memset(b,0,sizeof(*b));
 }
 
-int vorbis_book_init_encode(codebook *c,const static_codebook *s){
+/* When the lattice point nearest a residue vector isn't populated,
+   the encoder falls back to a search of the whole book.  Precompute
+   what that search needs: the populated entries alone (with the value
+   vectors the search would otherwise regenerate entry by entry) and a
+   good starting candidate for every lattice point.  Only books of the
+   kind the encoder uses (maptype 1, dim <= 8) that actually have
+   unpopulated entries get the tables. */
+static void _book_init_nearest(codebook *c){
+  const static_codebook *s=c->c;
+  int dim=s->dim;
+  int maxval=c->minval+c->delta*(c->quantvals-1);
+  int e[8]={0,0,0,0,0,0,0,0};
+  int *all;
+  long i,j,k,n=0;
+
+  if(s->maptype!=1 || dim<1 || dim>8)return;
+  for(i=0;i<s->entries;i++)
+    if(s->lengthlist[i]>0)n++;
+  if(n==0 || n==s->entries || n>32767)return;
+
+  c->enc_populated=n;
+  c->enc_entry=_ogg_malloc(n*sizeof(*c->enc_entry));
+  c->enc_value=_ogg_malloc(n*dim*sizeof(*c->enc_value));
+  c->enc_seed=_ogg_malloc(s->entries*sizeof(*c->enc_seed));
+  all=_ogg_malloc(s->entries*dim*sizeof(*all));
+
+  /* the same value patterning local_book_besterror assumes (that
+     created by the tools in vq/) */
+  for(i=0,n=0;i<s->entries;i++){
+    memcpy(all+i*dim,e,dim*sizeof(*e));
+    if(s->lengthlist[i]>0){
+      c->enc_entry[n]=i;
+      memcpy(c->enc_value+n*dim,e,dim*sizeof(*e));
+      n++;
+    }
+    if(i+1==s->entries)break;
+    j=0;
+    while(e[j]>=maxval)
+      e[j++]=0;
+    if(e[j]>=0)
+      e[j]+=c->delta;
+    e[j]= -e[j];
+  }
+
+  for(i=0;i<s->entries;i++){
+    int best=-1;
+    c->enc_seed[i]=0;
+    for(j=0;j<n;j++){
+      int this=0;
+      for(k=0;k<dim;k++){
+        int val=c->enc_value[j*dim+k]-all[i*dim+k];
+        this+=val*val;
+      }
+      if(best==-1 || this<best){
+        best=this;
+        c->enc_seed[i]=j;
+      }
+    }
+  }
+  _ogg_free(all);
+}
+
+static int _book_init_encode(codebook *c,const static_codebook *s){
 
   memset(c,0,sizeof(*c));
   c->c=s;
@@ -307,9 +381,37 @@ int vorbis_book_init_encode(codebook *c,const static_codebook *s){
   c->minval=(int)rint(_float32_unpack(s->q_min));
   c->delta=(int)rint(_float32_unpack(s->q_delta));
 
+  _book_init_nearest(c);
+
   return(0);
 }
 
+static void *_book_build(void *s){
+  codebook *c=_ogg_malloc(sizeof(*c));
+  if(c)_book_init_encode(c,s);
+  return c;
+}
+
+static void _book_destroy(void *c){
+  vorbis_book_clear(c);
+  _ogg_free(c);
+}
+
+int vorbis_book_init_encode(codebook *c,const static_codebook *s){
+  /* the encoder's template books are never freed, so the address
+     alone identifies one; streams using it share its tables */
+  if(!s->allocedp){
+    codebook *shared=_vorbis_cache_get(VC_BOOK,&s,sizeof(s),
+                                       _book_build,(void *)s,_book_destroy);
+    if(shared){
+      *c=*shared;
+      c->enc_shared=shared;
+      return(0);
+    }
+  }
+  return(_book_init_encode(c,s));
+}
+
 static ogg_uint32_t bitreverse(ogg_uint32_t x){
   x=    ((x>>16)&0x0000ffffUL) | ((x<<16)&0xffff0000UL);
   x=    ((x>> 8)&0x00ff00ffUL) | ((x<< 8)&0xff00ff00UL);
@@ -338,6 +440,7 @@ int vorbis_book_init_decode(codebook *c,const static_codebook *s){
   c->entries=s->entries;
   c->used_entries=n;
   c->dim=s->dim;
+  vorbis_book_select_kernels(c);
 
   if(n>0){
     /* two different remappings go on here.
@@ -376,6 +479,7 @@ int vorbis_book_init_decode(codebook *c,const static_codebook *s){
     _ogg_free(codes);
 
     c->valuelist=_book_unquantize(s,n,sortindex);
+    vorbis_book_compact_values(c);
     c->dec_index=_ogg_malloc(n*sizeof(*c->dec_index));
 
     for(n=0,i=0;i<s->entries;i++)
@@ -451,6 +555,33 @@ int vorbis_book_init_decode(codebook *c,const static_codebook *s){
   return(-1);
 }
 
+/* Decode tables are built on demand (see _vds_build_books); at setup
+   we only verify that the lengths describe a complete prefix code,
+   which is exactly the condition _make_words enforces, and fill in
+   the shape of the book that the backend lookups need. */
+int vorbis_book_check_decode(codebook *c,const static_codebook *s){
+  int i,n=0,maxlength=0;
+  ogg_int64_t kraft=0;
+
+  memset(c,0,sizeof(*c));
+
+  for(i=0;i<s->entries;i++)
+    if(s->lengthlist[i]>0){
+      kraft+=(ogg_int64_t)1<<(32-s->lengthlist[i]);
+      if(s->lengthlist[i]>maxlength)maxlength=s->lengthlist[i];
+      n++;
+    }
+
+  /* single-entry codebooks are the one allowed underpopulated tree */
+  if(n>0 && !(n==1 && maxlength==1) && kraft!=(ogg_int64_t)1<<32)
+    return(-1);
+
+  c->entries=s->entries;
+  c->used_entries=n;
+  c->dim=s->dim;
+  return(0);
+}
+
 long vorbis_book_codeword(codebook *book,int entry){
   if(book->c) /* only use with encode; decode optimizations are
                  allowed to break this */
@@ -1233,6 +1233,13 @@ void drft_forward(drft_lookup *l,float *data){
   drftf1(l->n,data,l->trigcache,l->trigcache+l->n,l->splitcache);
 }
 
+/* as drft_forward, but with caller supplied scratch of n floats in
+   place of the lookup's own, so that threads may share a lookup */
+void drft_forward_work(drft_lookup *l,float *data,float *work){
+  if(l->n==1)return;
+  drftf1(l->n,data,work,l->trigcache+l->n,l->splitcache);
+}
+
 void drft_backward(drft_lookup *l,float *data){
   if (l->n==1)return;
   drftb1(l->n,data,l->trigcache,l->trigcache+l->n,l->splitcache);
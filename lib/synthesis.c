@@ -81,6 +81,10 @@ int vorbis_synthesis(vorbis_block *vb,ogg_packet *op){
   for(i=0;i<vi->channels;i++)
     vb->pcm[i]=_vorbis_block_alloc(vb,vb->pcmend*sizeof(*vb->pcm[i]));
 
+  /* make sure the codebooks this mode uses are ready */
+  if(!b->books_ready[mode] && _vds_build_books(vd,mode))
+    return(OV_EBADPACKET);
+
   /* unpack_header enforces range checking */
   type=ci->map_type[ci->mode_param[mode]->mapping];
 
@@ -0,0 +1,261 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: minimal threading primitives (pthreads or Win32)
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <ogg/ogg.h>
+#include "thread.h"
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+} thread_start;
+
+#if defined(_WIN32)
+
+void _vorbis_mutex_init(vorbis_mutex *m){
+  InitializeSRWLock(m);
+}
+
+void _vorbis_mutex_clear(vorbis_mutex *m){
+  (void)m; /* SRW locks hold no resources */
+}
+
+void _vorbis_mutex_lock(vorbis_mutex *m){
+  AcquireSRWLockExclusive(m);
+}
+
+void _vorbis_mutex_unlock(vorbis_mutex *m){
+  ReleaseSRWLockExclusive(m);
+}
+
+void _vorbis_cond_init(vorbis_cond *c){
+  InitializeConditionVariable(c);
+}
+
+void _vorbis_cond_clear(vorbis_cond *c){
+  (void)c;
+}
+
+void _vorbis_cond_wait(vorbis_cond *c,vorbis_mutex *m){
+  SleepConditionVariableSRW(c,m,INFINITE,0);
+}
+
+void _vorbis_cond_signal(vorbis_cond *c){
+  WakeConditionVariable(c);
+}
+
+void _vorbis_cond_broadcast(vorbis_cond *c){
+  WakeAllConditionVariable(c);
+}
+
+static DWORD WINAPI thread_main(LPVOID arg){
+  thread_start start=*(thread_start *)arg;
+  _ogg_free(arg);
+  start.func(start.arg);
+  return 0;
+}
+
+int _vorbis_thread_create(vorbis_thread *t,void (*func)(void *),void *arg){
+  thread_start *start=_ogg_malloc(sizeof(*start));
+  if(!start)return -1;
+  start->func=func;
+  start->arg=arg;
+  *t=CreateThread(NULL,0,thread_main,start,0,NULL);
+  if(*t==NULL){
+    _ogg_free(start);
+    return -1;
+  }
+  return 0;
+}
+
+void _vorbis_thread_join(vorbis_thread *t){
+  WaitForSingleObject(*t,INFINITE);
+  CloseHandle(*t);
+}
+
+#else
+
+void _vorbis_mutex_init(vorbis_mutex *m){
+  pthread_mutex_init(m,NULL);
+}
+
+void _vorbis_mutex_clear(vorbis_mutex *m){
+  pthread_mutex_destroy(m);
+}
+
+void _vorbis_mutex_lock(vorbis_mutex *m){
+  pthread_mutex_lock(m);
+}
+
+void _vorbis_mutex_unlock(vorbis_mutex *m){
+  pthread_mutex_unlock(m);
+}
+
+void _vorbis_cond_init(vorbis_cond *c){
+  pthread_cond_init(c,NULL);
+}
+
+void _vorbis_cond_clear(vorbis_cond *c){
+  pthread_cond_destroy(c);
+}
+
+void _vorbis_cond_wait(vorbis_cond *c,vorbis_mutex *m){
+  pthread_cond_wait(c,m);
+}
+
+void _vorbis_cond_signal(vorbis_cond *c){
+  pthread_cond_signal(c);
+}
+
+void _vorbis_cond_broadcast(vorbis_cond *c){
+  pthread_cond_broadcast(c);
+}
+
+static void *thread_main(void *arg){
+  thread_start start=*(thread_start *)arg;
+  _ogg_free(arg);
+  start.func(start.arg);
+  return NULL;
+}
+
+int _vorbis_thread_create(vorbis_thread *t,void (*func)(void *),void *arg){
+  thread_start *start=_ogg_malloc(sizeof(*start));
+  if(!start)return -1;
+  start->func=func;
+  start->arg=arg;
+  if(pthread_create(t,NULL,thread_main,start)){
+    _ogg_free(start);
+    return -1;
+  }
+  return 0;
+}
+
+void _vorbis_thread_join(vorbis_thread *t){
+  pthread_join(*t,NULL);
+}
+
+#endif
+
+/* job pool *********************************************************/
+
+struct vorbis_pool {
+  int            threads; /* workers, not counting the submitter */
+  vorbis_thread *thread;
+
+  vorbis_mutex   lock;
+  vorbis_cond    wake;    /* a batch was posted, or shutdown */
+  vorbis_cond    done;    /* the last job of a batch finished */
+
+  void         (*job)(void *,int);
+  void          *arg;
+  int            count;
+  int            next;    /* next unclaimed job */
+  int            pending; /* claimed or unclaimed, not yet finished */
+  int            quit;
+};
+
+/* called and returns with the lock held */
+static void pool_work(vorbis_pool *p){
+  while(p->next<p->count){
+    int i=p->next++;
+    _vorbis_mutex_unlock(&p->lock);
+    p->job(p->arg,i);
+    _vorbis_mutex_lock(&p->lock);
+    if(--p->pending==0)_vorbis_cond_signal(&p->done);
+  }
+}
+
+static void pool_main(void *arg){
+  vorbis_pool *p=arg;
+  _vorbis_mutex_lock(&p->lock);
+  while(!p->quit){
+    pool_work(p);
+    if(!p->quit)_vorbis_cond_wait(&p->wake,&p->lock);
+  }
+  _vorbis_mutex_unlock(&p->lock);
+}
+
+vorbis_pool *_vorbis_pool_create(int threads){
+  vorbis_pool *p;
+  int i;
+
+  if(threads<2)return NULL;
+  p=_ogg_calloc(1,sizeof(*p));
+  if(!p)return NULL;
+  p->thread=_ogg_calloc(threads-1,sizeof(*p->thread));
+  if(!p->thread){
+    _ogg_free(p);
+    return NULL;
+  }
+  _vorbis_mutex_init(&p->lock);
+  _vorbis_cond_init(&p->wake);
+  _vorbis_cond_init(&p->done);
+
+  for(i=0;i<threads-1;i++){
+    if(_vorbis_thread_create(p->thread+i,pool_main,p))break;
+    p->threads++;
+  }
+  if(p->threads==0){
+    _vorbis_pool_destroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+void _vorbis_pool_destroy(vorbis_pool *p){
+  int i;
+  if(p){
+    _vorbis_mutex_lock(&p->lock);
+    p->quit=1;
+    _vorbis_cond_broadcast(&p->wake);
+    _vorbis_mutex_unlock(&p->lock);
+    for(i=0;i<p->threads;i++)
+      _vorbis_thread_join(p->thread+i);
+
+    _vorbis_cond_clear(&p->done);
+    _vorbis_cond_clear(&p->wake);
+    _vorbis_mutex_clear(&p->lock);
+    _ogg_free(p->thread);
+    _ogg_free(p);
+  }
+}
+
+int _vorbis_pool_threads(vorbis_pool *p){
+  return p?p->threads+1:1;
+}
+
+void _vorbis_pool_run(vorbis_pool *p,void (*job)(void *,int),
+                      void *arg,int count){
+  int i;
+  if(!p || count<2){
+    for(i=0;i<count;i++)job(arg,i);
+    return;
+  }
+
+  _vorbis_mutex_lock(&p->lock);
+  p->job=job;
+  p->arg=arg;
+  p->count=count;
+  p->next=0;
+  p->pending=count;
+  _vorbis_cond_broadcast(&p->wake);
+
+  pool_work(p);
+  while(p->pending)
+    _vorbis_cond_wait(&p->done,&p->lock);
+  p->count=0;
+  _vorbis_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,62 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: minimal threading primitives (pthreads or Win32)
+
+ ********************************************************************/
+
+#ifndef _V_THREAD_H_
+#define _V_THREAD_H_
+
+#if defined(_WIN32)
+#  include <windows.h>
+typedef SRWLOCK vorbis_mutex;
+typedef CONDITION_VARIABLE vorbis_cond;
+typedef HANDLE vorbis_thread;
+#  define VORBIS_MUTEX_INITIALIZER SRWLOCK_INIT
+#else
+#  include <pthread.h>
+typedef pthread_mutex_t vorbis_mutex;
+typedef pthread_cond_t vorbis_cond;
+typedef pthread_t vorbis_thread;
+#  define VORBIS_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#endif
+
+extern void _vorbis_mutex_init(vorbis_mutex *m);
+extern void _vorbis_mutex_clear(vorbis_mutex *m);
+extern void _vorbis_mutex_lock(vorbis_mutex *m);
+extern void _vorbis_mutex_unlock(vorbis_mutex *m);
+
+extern void _vorbis_cond_init(vorbis_cond *c);
+extern void _vorbis_cond_clear(vorbis_cond *c);
+extern void _vorbis_cond_wait(vorbis_cond *c,vorbis_mutex *m);
+extern void _vorbis_cond_signal(vorbis_cond *c);
+extern void _vorbis_cond_broadcast(vorbis_cond *c);
+
+/* returns nonzero if the thread could not be started */
+extern int  _vorbis_thread_create(vorbis_thread *t,
+                                  void (*func)(void *),void *arg);
+extern void _vorbis_thread_join(vorbis_thread *t);
+
+/* a fixed set of worker threads that run batches of independent
+   jobs; the submitting thread takes jobs as well and returns only
+   once the whole batch is done.  Jobs are numbered 0..count-1 and
+   may run in any order on any thread. */
+typedef struct vorbis_pool vorbis_pool;
+
+extern vorbis_pool *_vorbis_pool_create(int threads);
+extern void _vorbis_pool_destroy(vorbis_pool *p);
+extern int  _vorbis_pool_threads(vorbis_pool *p);
+extern void _vorbis_pool_run(vorbis_pool *p,void (*job)(void *,int),
+                             void *arg,int count);
+
+#endif
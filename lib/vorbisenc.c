@@ -216,6 +216,9 @@ static void vorbis_encode_floor_setup(vorbis_info *vi,int s,
       ci->book_param[ci->books++]=(static_codebook *)books[x[is]][i];
   }
 
+  /* speed level 3 and up accepts a coarser floor fit */
+  if(ci->hi.speed>=3)f->maxerr*=4.f;
+
   /* for now, we're only using floor 1 */
   ci->floor_type[ci->floors]=1;
   ci->floor_param[ci->floors]=f;
@@ -248,6 +251,13 @@ static void vorbis_encode_global_psych_setup(vorbis_info *vi,double s,
     g->postecho_thresh[i]=in[is].postecho_thresh[i]*(1.-ds)+in[is+1].postecho_thresh[i]*ds;
   }
   g->ampmax_att_per_sec=ci->hi.amplitude_track_dBpersec;
+  g->mdct_tonemask=(ci->hi.speed>=2);
+  if(ci->hi.low_latency_p)
+    g->fixed_blocksize=1;
+  else if(ci->hi.speed>=3)
+    g->fixed_blocksize=2;
+  else
+    g->fixed_blocksize=0;
   return;
 }
 
@@ -670,6 +680,27 @@ static const void *get_setup_template(long ch,long srate,
   return NULL;
 }
 
+/* input samples the encoder may hold beyond the last sample a decoder
+   can finish from the packets emitted so far; mirrors the data
+   requirements of vorbis_analysis_blockout() */
+static long vorbis_encode_latency(codec_setup_info *ci){
+  long s=ci->blocksizes[0];
+  long l=ci->blocksizes[1];
+  long search;
+
+  switch(ci->psy_g_param.fixed_blocksize){
+  case 1:
+    return(s);
+  case 2:
+    return(l);
+  }
+
+  /* _ve_envelope_search() looks past the next long block and works
+     back one search window */
+  search=l*3/4+s/4+(VE_WIN+2)*VE_SEARCHSTEP;
+  return(search>l?search:l);
+}
+
 /* encoders will need to use vorbis_info_init beforehand and call
    vorbis_info clear when all done */
 
@@ -685,6 +716,7 @@ int vorbis_encode_setup_init(vorbis_info *vi){
 
   if(ci==NULL)return(OV_EINVAL);
   if(vi->channels<1||vi->channels>255)return(OV_EINVAL);
+  if(hi->speed>=1)hi->noise_normalize_p=0;
   if(!hi->impulse_block_p)i0=1;
 
   /* too low/high an ATH floater is nonsensical, but doesn't break anything */
@@ -1025,7 +1057,10 @@ int vorbis_encode_ctl(vorbis_info *vi,int number,void *arg){
     highlevel_encode_setup *hi=&ci->hi;
     int setp=(number&0xf); /* a read request has a low nibble of 0 */
 
-    if(setp && hi->set_in_stone)return(OV_EINVAL);
+    /* the thread count does not alter the bitstream and may be
+       changed up until vorbis_analysis_init() */
+    if(setp && hi->set_in_stone && number!=OV_ECTL_THREADS_SET)
+      return(OV_EINVAL);
 
     switch(number){
 
@@ -1217,6 +1252,51 @@ int vorbis_encode_ctl(vorbis_info *vi,int number,void *arg){
         vorbis_encode_setup_setting(vi,vi->channels,vi->rate);
       }
       return(0);
+    case OV_ECTL_THREADS_GET:
+      {
+        int *iarg=(int *)arg;
+        *iarg=(hi->threads>1?hi->threads:1);
+      }
+      return(0);
+    case OV_ECTL_THREADS_SET:
+      {
+        int *iarg=(int *)arg;
+        if(*iarg<1)return(OV_EINVAL);
+        hi->threads=(*iarg>ENCODE_MAXTHREADS?ENCODE_MAXTHREADS:*iarg);
+      }
+      return(0);
+    case OV_ECTL_SPEED_GET:
+      {
+        int *iarg=(int *)arg;
+        *iarg=hi->speed;
+      }
+      return(0);
+    case OV_ECTL_SPEED_SET:
+      {
+        int *iarg=(int *)arg;
+        if(*iarg<0)return(OV_EINVAL);
+        hi->speed=(*iarg>3?3:*iarg);
+      }
+      return(0);
+    case OV_ECTL_LOWLATENCY_GET:
+      {
+        int *iarg=(int *)arg;
+        *iarg=hi->low_latency_p;
+      }
+      return(0);
+    case OV_ECTL_LOWLATENCY_SET:
+      {
+        int *iarg=(int *)arg;
+        hi->low_latency_p=((*iarg)!=0);
+      }
+      return(0);
+    case OV_ECTL_LATENCY_GET:
+      {
+        long *larg=(long *)arg;
+        if(!hi->set_in_stone)return(OV_EINVAL);
+        *larg=vorbis_encode_latency(ci);
+      }
+      return(0);
     }
     return(OV_EIMPL);
   }
@@ -0,0 +1,325 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: bark_noise_hybridmp against the single loop it replaced
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* for the static bark_noise_hybridmp */
+#include "psy.c"
+
+/* bark_noise_hybridmp before the window sums were gathered ahead of
+   the regression; the masks must not change by a bit */
+static void bark_noise_scalar(int n,const long *b,
+                              const float *f,
+                              float *noise,
+                              const float offset,
+                              const int fixed){
+
+  float *N=alloca(n*sizeof(*N));
+  float *X=alloca(n*sizeof(*N));
+  float *XX=alloca(n*sizeof(*N));
+  float *Y=alloca(n*sizeof(*N));
+  float *XY=alloca(n*sizeof(*N));
+
+  float tN, tX, tXX, tY, tXY;
+  int i;
+
+  int lo, hi;
+  float R=0.f;
+  float A=0.f;
+  float B=0.f;
+  float D=1.f;
+  float w, x, y;
+
+  tN = tX = tXX = tY = tXY = 0.f;
+
+  y = f[0] + offset;
+  if (y < 1.f) y = 1.f;
+
+  w = y * y * .5;
+
+  tN += w;
+  tX += w;
+  tY += w * y;
+
+  N[0] = tN;
+  X[0] = tX;
+  XX[0] = tXX;
+  Y[0] = tY;
+  XY[0] = tXY;
+
+  for (i = 1, x = 1.f; i < n; i++, x += 1.f) {
+
+    y = f[i] + offset;
+    if (y < 1.f) y = 1.f;
+
+    w = y * y;
+
+    tN += w;
+    tX += w * x;
+    tXX += w * x * x;
+    tY += w * y;
+    tXY += w * x * y;
+
+    N[i] = tN;
+    X[i] = tX;
+    XX[i] = tXX;
+    Y[i] = tY;
+    XY[i] = tXY;
+  }
+
+  for (i = 0, x = 0.f; i < n; i++, x += 1.f) {
+
+    lo = b[i] >> 16;
+    hi = b[i] & 0xffff;
+    if( lo>=0 || -lo>=n ) break;
+    if( hi>=n ) break;
+
+    tN = N[hi] + N[-lo];
+    tX = X[hi] - X[-lo];
+    tXX = XX[hi] + XX[-lo];
+    tY = Y[hi] + Y[-lo];
+    tXY = XY[hi] - XY[-lo];
+
+    A = tY * tXX - tX * tXY;
+    B = tN * tXY - tX * tY;
+    D = tN * tXX - tX * tX;
+    R = (A + x * B) / D;
+    if (R < 0.f) R = 0.f;
+
+    noise[i] = R - offset;
+  }
+
+  for ( ; i < n; i++, x += 1.f) {
+
+    lo = b[i] >> 16;
+    hi = b[i] & 0xffff;
+    if( lo<0 || lo>=n ) break;
+    if( hi>=n ) break;
+
+    tN = N[hi] - N[lo];
+    tX = X[hi] - X[lo];
+    tXX = XX[hi] - XX[lo];
+    tY = Y[hi] - Y[lo];
+    tXY = XY[hi] - XY[lo];
+
+    A = tY * tXX - tX * tXY;
+    B = tN * tXY - tX * tY;
+    D = tN * tXX - tX * tX;
+    R = (A + x * B) / D;
+    if (R < 0.f) R = 0.f;
+
+    noise[i] = R - offset;
+  }
+
+  for ( ; i < n; i++, x += 1.f) {
+
+    R = (A + x * B) / D;
+    if (R < 0.f) R = 0.f;
+
+    noise[i] = R - offset;
+  }
+
+  if (fixed <= 0) return;
+
+  for (i = 0, x = 0.f; i < n; i++, x += 1.f) {
+    hi = i + fixed / 2;
+    lo = hi - fixed;
+    if ( hi>=n ) break;
+    if ( lo>=0 ) break;
+
+    tN = N[hi] + N[-lo];
+    tX = X[hi] - X[-lo];
+    tXX = XX[hi] + XX[-lo];
+    tY = Y[hi] + Y[-lo];
+    tXY = XY[hi] - XY[-lo];
+
+
+    A = tY * tXX - tX * tXY;
+    B = tN * tXY - tX * tY;
+    D = tN * tXX - tX * tX;
+    R = (A + x * B) / D;
+
+    if (R - offset < noise[i]) noise[i] = R - offset;
+  }
+  for ( ; i < n; i++, x += 1.f) {
+
+    hi = i + fixed / 2;
+    lo = hi - fixed;
+    if ( hi>=n ) break;
+    if ( lo<0 ) break;
+
+    tN = N[hi] - N[lo];
+    tX = X[hi] - X[lo];
+    tXX = XX[hi] - XX[lo];
+    tY = Y[hi] - Y[lo];
+    tXY = XY[hi] - XY[lo];
+
+    A = tY * tXX - tX * tXY;
+    B = tN * tXY - tX * tY;
+    D = tN * tXX - tX * tX;
+    R = (A + x * B) / D;
+
+    if (R - offset < noise[i]) noise[i] = R - offset;
+  }
+  for ( ; i < n; i++, x += 1.f) {
+    R = (A + x * B) / D;
+    if (R - offset < noise[i]) noise[i] = R - offset;
+  }
+}
+
+#define MAXN 1100
+
+/* lengths around and between vector widths, and the real ones */
+static const int lengths [] = {
+  1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 127, 255, 257, 1023, 1024, 1025
+} ;
+
+/* how wide each bin's window is; lo and hi as p->bark holds them */
+enum {
+  WINDOW_BARK,      /* widening with frequency: lo mirrored below bin
+                       0 at the start, hi clamped to n at the end */
+  WINDOW_NARROW,    /* one bin either side */
+  WINDOW_WIDE,      /* wider than the spectrum: nothing but the
+                       extrapolated tail */
+  WINDOWS
+} ;
+
+static const char *window_names [] = {
+  "bark-like windows, clamped at both ends",
+  "narrow windows",
+  "windows wider than the spectrum"
+} ;
+
+/* the spectra */
+enum {
+  SPECTRUM_RANDOM,      /* -160 to 0 dB, as _vp_noisemask's first pass sees */
+  SPECTRUM_RESIDUE,     /* -20 to 20 dB, as its second pass sees */
+  SPECTRUM_FLOOR,       /* far below the offset, every bin clamped to 1 */
+  SPECTRUM_FLAT,
+  SPECTRUM_SPIKE,
+  SPECTRA
+} ;
+
+static void
+make_windows (long *b, int n, int shape)
+{
+  int i ;
+
+  for (i = 0 ; i < n ; i++) {
+    int w, lo, hi ;
+
+    switch (shape) {
+    case WINDOW_BARK:
+      w = 3 + i / 4 ;
+      break ;
+    case WINDOW_NARROW:
+      w = 1 ;
+      break ;
+    default:
+      w = n + 5 ;
+      break ;
+    }
+    lo = i - w ;
+    hi = i + w ;
+    if (hi > n) hi = n ;
+    b [i] = lo * 65536L + hi ;
+  }
+}
+
+static void
+make_spectrum (float *f, int n, int kind, unsigned long *seed)
+{
+  int i ;
+
+  for (i = 0 ; i < n ; i++) {
+    float r ;
+
+    *seed = *seed * 1664525UL + 1013904223UL ;
+    r = (float) ((*seed >> 8) & 0xffff) / 65536.f ;
+    switch (kind) {
+    case SPECTRUM_RANDOM:
+      f [i] = -160.f * r ;
+      break ;
+    case SPECTRUM_RESIDUE:
+      f [i] = 40.f * r - 20.f ;
+      break ;
+    case SPECTRUM_FLOOR:
+      f [i] = -1000.f ;
+      break ;
+    case SPECTRUM_FLAT:
+      f [i] = -30.f ;
+      break ;
+    default:
+      f [i] = i == n / 3 ? -10.f : -120.f ;
+      break ;
+    }
+  }
+}
+
+int
+main (void)
+{
+  static const float offsets [] = { 140.f, 0.f } ;
+  static long b [MAXN] ;
+  static float f [MAXN], noise [MAXN], expect [MAXN] ;
+  unsigned long seed = 12345 ;
+  int shape, errors = 0 ;
+
+  for (shape = 0 ; shape < WINDOWS ; shape++) {
+    unsigned k, o ;
+    int kind, failed = 0 ;
+
+    printf ("    %-50s : ", window_names [shape]) ;
+    for (k = 0 ; k < sizeof (lengths) / sizeof (*lengths) ; k++) {
+      int n = lengths [k] ;
+      /* no fixed window, odd and even, and one too wide to fit */
+      int fixed [] = { -1, 0, 1, 8, 9, 0 } ;
+      unsigned j ;
+
+      fixed [5] = 2 * n + 3 ;
+      make_windows (b, n, shape) ;
+      for (kind = 0 ; kind < SPECTRA ; kind++)
+        for (o = 0 ; o < sizeof (offsets) / sizeof (*offsets) ; o++)
+          for (j = 0 ; j < sizeof (fixed) / sizeof (*fixed) ; j++) {
+            /* an odd fixed window whose first bin ends on the last one
+               reaches one past the end below bin 0, in both versions;
+               the encoder's windows are far narrower than the spectrum */
+            if (fixed [j] / 2 == n - 1 && fixed [j] - fixed [j] / 2 >= n)
+              continue ;
+            make_spectrum (f, n, kind, &seed) ;
+            memset (noise, 0, sizeof (noise)) ;
+            memset (expect, 0, sizeof (expect)) ;
+            bark_noise_hybridmp (n, b, f, noise, offsets [o], fixed [j]) ;
+            bark_noise_scalar (n, b, f, expect, offsets [o], fixed [j]) ;
+            if (memcmp (noise, expect, sizeof (*noise) * n)) {
+              if (failed++ == 0)
+                printf ("Error : n %d spectrum %d offset %g fixed %d differs.\n",
+                        n, kind, offsets [o], fixed [j]) ;
+            }
+          }
+    }
+    if (failed == 0)
+      puts ("ok") ;
+    errors += failed ;
+  }
+
+  if (errors)
+    exit (1) ;
+
+  return 0 ;
+}
@@ -0,0 +1,176 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: residue decode kernels against the generic loops, and
+           their speed per codebook dimension
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ogg/ogg.h>
+#include "codebook.h"
+
+#define ENTRIES     256
+#define PARTITION   48
+#define PARTITIONS  4096
+#define REPEATS     16
+
+typedef long (*decode_kernel)(codebook *book, float *a, oggpack_buffer *b, int n);
+
+/* an ENTRIES-entry book of the given dimension with listed lattice
+   values, the shape the residue books use */
+static void
+make_book (static_codebook *s, int dim)
+{
+  long i ;
+
+  memset (s, 0, sizeof (*s)) ;
+  s->dim = dim ;
+  s->entries = ENTRIES ;
+  s->lengthlist = malloc (ENTRIES) ;
+  for (i = 0 ; i < ENTRIES ; i++)
+    s->lengthlist [i] = 8 ;
+  s->maptype = 2 ;
+  s->allocedp = 1 ;
+  s->q_min = _float32_pack (-8.f) ;
+  s->q_delta = _float32_pack (1.f) ;
+  s->q_quant = 4 ;
+  s->quantlist = malloc (sizeof (*s->quantlist) * ENTRIES * dim) ;
+  for (i = 0 ; i < ENTRIES * dim ; i++)
+    s->quantlist [i] = rand () & 15 ;
+}
+
+/* vorbis_book_decodev_add (interleaved=0) or vorbis_book_decodevs_add
+   (interleaved=1) as the spec defines them */
+static void
+reference (const static_codebook *s, const int *entry, float *a, int interleaved)
+{
+  int step = PARTITION / s->dim ;
+  int p, i, j ;
+
+  for (p = 0 ; p < PARTITIONS ; p++, entry += step, a += PARTITION)
+    for (i = 0 ; i < step ; i++)
+      for (j = 0 ; j < s->dim ; j++)
+        a [interleaved ? j * step + i : i * s->dim + j] +=
+          (float) (s->quantlist [entry [i] * s->dim + j] - 8) ;
+}
+
+static double
+run (codebook *book, decode_kernel kernel, unsigned char *data, long bytes,
+     float *a, int repeats)
+{
+  clock_t start = clock () ;
+  int r, p ;
+
+  for (r = 0 ; r < repeats ; r++) {
+    oggpack_buffer opb ;
+    oggpack_readinit (&opb, data, bytes) ;
+    memset (a, 0, sizeof (*a) * PARTITION * PARTITIONS) ;
+    for (p = 0 ; p < PARTITIONS ; p++)
+      if (kernel (book, a + p * PARTITION, &opb, PARTITION) != 0) {
+        printf ("Error : dim %ld kernel hit end of packet.\n", book->dim) ;
+        exit (1) ;
+      }
+  }
+
+  return (double) (clock () - start) / CLOCKS_PER_SEC
+    / ((double) repeats * PARTITION * PARTITIONS) * 1e9 ;
+}
+
+int
+main (void)
+{
+  static const int dims [] = { 1, 2, 4, 8 } ;
+  static float a [PARTITION * PARTITIONS], ref [PARTITION * PARTITIONS] ;
+  static_codebook s ;
+  codebook generic, enc, dec ;
+  int *entry = malloc (sizeof (*entry) * PARTITION * PARTITIONS) ;
+  int d, i, errors = 0 ;
+
+  /* a dimension without a kernel of its own yields the generic loops */
+  make_book (&s, 3) ;
+  if (vorbis_book_init_decode (&generic, &s) != 0) {
+    printf ("Error : vorbis_book_init_decode failed.\n") ;
+    exit (1) ;
+  }
+
+  printf ("   dim   decodev_add ns/value    decodevs_add ns/value\n") ;
+  printf ("          kernel   generic        kernel   generic\n") ;
+
+  for (d = 0 ; d < (int) (sizeof (dims) / sizeof (*dims)) ; d++) {
+    oggpack_buffer opb ;
+    unsigned char *data ;
+    long bytes ;
+    int n = PARTITION / dims [d] * PARTITIONS ;
+    double t [4] ;
+
+    free (s.lengthlist) ;
+    free (s.quantlist) ;
+    make_book (&s, dims [d]) ;
+    if (vorbis_book_init_encode (&enc, &s) != 0 ||
+        vorbis_book_init_decode (&dec, &s) != 0) {
+      printf ("Error : dim %d book init failed.\n", dims [d]) ;
+      exit (1) ;
+    }
+
+    oggpack_writeinit (&opb) ;
+    for (i = 0 ; i < n ; i++) {
+      entry [i] = rand () % ENTRIES ;
+      vorbis_book_encode (&enc, entry [i], &opb) ;
+    }
+    bytes = oggpack_bytes (&opb) ;
+    data = malloc (bytes) ;
+    memcpy (data, oggpack_get_buffer (&opb), bytes) ;
+    oggpack_writeclear (&opb) ;
+
+    /* every kernel has to reproduce the spec's sum bit for bit */
+    memset (ref, 0, sizeof (ref)) ;
+    reference (&s, entry, ref, 0) ;
+    run (&dec, dec.dec_vadd, data, bytes, a, 1) ;
+    errors += memcmp (a, ref, sizeof (a)) != 0 ;
+    run (&dec, generic.dec_vadd, data, bytes, a, 1) ;
+    errors += memcmp (a, ref, sizeof (a)) != 0 ;
+
+    memset (ref, 0, sizeof (ref)) ;
+    reference (&s, entry, ref, 1) ;
+    run (&dec, dec.dec_vsadd, data, bytes, a, 1) ;
+    errors += memcmp (a, ref, sizeof (a)) != 0 ;
+    run (&dec, generic.dec_vsadd, data, bytes, a, 1) ;
+    errors += memcmp (a, ref, sizeof (a)) != 0 ;
+
+    if (errors) {
+      printf ("Error : dim %d kernel output differs from the spec.\n", dims [d]) ;
+      exit (1) ;
+    }
+
+    t [0] = run (&dec, dec.dec_vadd, data, bytes, a, REPEATS) ;
+    t [1] = run (&dec, generic.dec_vadd, data, bytes, a, REPEATS) ;
+    t [2] = run (&dec, dec.dec_vsadd, data, bytes, a, REPEATS) ;
+    t [3] = run (&dec, generic.dec_vsadd, data, bytes, a, REPEATS) ;
+    printf ("   %3d   %8.2f  %8.2f      %8.2f  %8.2f\n",
+            dims [d], t [0], t [1], t [2], t [3]) ;
+
+    free (data) ;
+    vorbis_book_clear (&enc) ;
+    vorbis_book_clear (&dec) ;
+  }
+
+  vorbis_book_clear (&generic) ;
+  free (s.lengthlist) ;
+  free (s.quantlist) ;
+  free (entry) ;
+  return 0 ;
+}
@@ -0,0 +1,333 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: encoder options that must not change the bitstream
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vorbis/codec.h>
+#include <vorbis/vorbisenc.h>
+
+#include "util.h"
+
+#ifndef M_PI
+#  define M_PI (3.1415926536f)
+#endif
+
+#define SECONDS   3
+#define CHUNK     1000
+
+typedef struct {
+  const char *name ;
+  int channels ;
+  long rate ;
+  float quality ;   /* VBR quality, if bitrate is 0 */
+  long bitrate ;    /* managed nominal bitrate */
+} encode_setup ;
+
+/* how encode() hands the input to the encoder */
+enum {
+  FEED_BUFFER,      /* deinterleaved into vorbis_analysis_buffer */
+  FEED_F32,         /* vorbis_analysis_write_interleaved_f32 */
+  FEED_S16,         /* vorbis_analysis_write_interleaved_s16 */
+  FEED_S24          /* vorbis_analysis_write_interleaved_s24 */
+} ;
+
+typedef struct {
+  unsigned char *data ;
+  long bytes ;
+  long *sizes ;
+  ogg_int64_t *granules ;
+  long packets ;
+} packet_list ;
+
+static const encode_setup setups [] = {
+  { "mono 22050 managed 48k",  1, 22050,  0.f,  48000 },
+  { "stereo 44100 managed 128k", 2, 44100, 0.f, 128000 },
+  { "stereo 44100 q0.5",       2, 44100,  .5f,      0 },
+  { "5.1 48000 q0.2",          6, 48000,  .2f,      0 },
+} ;
+
+/* tones, a noise floor and a burst three times a second, so that both
+   block sizes occur */
+static float *
+make_input (int ch, long rate, long frames)
+{
+  float *pcm = malloc (sizeof (*pcm) * ch * frames) ;
+  unsigned long seed = 12345 ;
+  long i ;
+  int j ;
+
+  for (i = 0 ; i < frames ; i++) {
+    float t = (float) i / rate ;
+    float tone = .3f * sin (2 * M_PI * 440 * t) + .1f * sin (2 * M_PI * 3150 * t) ;
+    float burst = (i % (rate / 3)) < rate / 50 ? .5f : 0.f ;
+    for (j = 0 ; j < ch ; j++) {
+      float noise ;
+      seed = seed * 1664525UL + 1013904223UL ;
+      noise = (float) ((seed >> 8) & 0xffff) / 32768.f - 1.f ;
+      pcm [i * ch + j] = tone * (1.f - .1f * j) + (.02f + burst) * noise ;
+    }
+  }
+  return pcm ;
+}
+
+/* the input rounded to 16 or 24 bit integers (s16 native, s24 packed
+   little endian) and, in float, exactly the values the interleaved
+   writers convert those to.  The first frames hold the extremes and
+   -1, which only come out right if s24 is sign extended. */
+static void
+make_integer_input (const float *pcm, int ch, long frames, int bits,
+                    void *ints, float *as_float)
+{
+  static const long first [] = { -8388608, 8388607, -1, 1, -256 } ;
+  long max = (1L << (bits - 1)) - 1 ;
+  long i ;
+
+  for (i = 0 ; i < frames * ch ; i++) {
+    long v = (long) floor (pcm [i] * (max + 1) + .5) ;
+
+    if (i / ch < (long) ARRAY_LEN (first))
+      v = first [i / ch] >> (24 - bits) ;
+    if (v > max) v = max ;
+    if (v < -max - 1) v = -max - 1 ;
+
+    if (bits == 16) {
+      ((short *) ints) [i] = (short) v ;
+      as_float [i] = v * (1.f / 32768.f) ;
+    } else {
+      unsigned char *p = (unsigned char *) ints + i * 3 ;
+      p [0] = v & 0xff ;
+      p [1] = (v >> 8) & 0xff ;
+      p [2] = (v >> 16) & 0xff ;
+      as_float [i] = v * (1.f / 8388608.f) ;
+    }
+  }
+}
+
+static void
+keep_packet (packet_list *list, const ogg_packet *op)
+{
+  list->data = realloc (list->data, list->bytes + op->bytes) ;
+  list->sizes = realloc (list->sizes, sizeof (*list->sizes) * (list->packets + 1)) ;
+  list->granules = realloc (list->granules, sizeof (*list->granules) * (list->packets + 1)) ;
+  memcpy (list->data + list->bytes, op->packet, op->bytes) ;
+  list->bytes += op->bytes ;
+  list->sizes [list->packets] = op->bytes ;
+  list->granules [list->packets] = op->granulepos ;
+  list->packets ++ ;
+}
+
+static void
+free_packets (packet_list *list)
+{
+  free (list->data) ;
+  free (list->sizes) ;
+  free (list->granules) ;
+  memset (list, 0, sizeof (*list)) ;
+}
+
+/* encode interleaved input of the given feed type, keeping every
+   packet.  Packets come from the blockout/analysis/bitrate loop, or
+   from vorbis_analysis_packetout if pipelined. */
+static void
+encode (const encode_setup *s, int threads, int pipelined,
+        int feed, const void *pcm, long frames, packet_list *out)
+{
+  vorbis_info vi ;
+  vorbis_comment vc ;
+  vorbis_dsp_state vd ;
+  vorbis_block vb ;
+  ogg_packet op, header, header_comm, header_code ;
+  long done = 0 ;
+  int ret, eos = 0 ;
+
+  memset (out, 0, sizeof (*out)) ;
+  vorbis_info_init (&vi) ;
+  if (s->bitrate > 0)
+    ret = vorbis_encode_init (&vi, s->channels, s->rate, -1, s->bitrate, -1) ;
+  else
+    ret = vorbis_encode_init_vbr (&vi, s->channels, s->rate, s->quality) ;
+  if (ret == 0)
+    ret = vorbis_encode_ctl (&vi, OV_ECTL_THREADS_SET, &threads) ;
+  if (ret) {
+    printf ("Error : %s encoder setup returned %d\n", s->name, ret) ;
+    exit (1) ;
+  }
+
+  vorbis_comment_init (&vc) ;
+  vorbis_analysis_init (&vd, &vi) ;
+  vorbis_block_init (&vd, &vb) ;
+  vorbis_analysis_headerout (&vd, &vc, &header, &header_comm, &header_code) ;
+  keep_packet (out, &header) ;
+  keep_packet (out, &header_comm) ;
+  keep_packet (out, &header_code) ;
+
+  while (!eos) {
+    long n = frames - done < CHUNK ? frames - done : CHUNK ;
+    long at = done * s->channels ;
+
+    switch (feed) {
+    case FEED_BUFFER:
+      if (n > 0) {
+        float **buffer = vorbis_analysis_buffer (&vd, n) ;
+        long i ;
+        int j ;
+
+        for (j = 0 ; j < s->channels ; j++)
+          for (i = 0 ; i < n ; i++)
+            buffer [j][i] = ((const float *) pcm) [at + i * s->channels + j] ;
+      }
+      ret = vorbis_analysis_wrote (&vd, n) ;
+      break ;
+    case FEED_F32:
+      ret = vorbis_analysis_write_interleaved_f32 (&vd, n ? (const float *) pcm + at : NULL, n) ;
+      break ;
+    case FEED_S16:
+      ret = vorbis_analysis_write_interleaved_s16 (&vd, n ? (const short *) pcm + at : NULL, n) ;
+      break ;
+    default:
+      ret = vorbis_analysis_write_interleaved_s24 (&vd, n ? (const unsigned char *) pcm + at * 3 : NULL, n) ;
+      break ;
+    }
+    if (ret) {
+      printf ("Error : %s input returned %d\n", s->name, ret) ;
+      exit (1) ;
+    }
+    done += n ;
+
+    if (pipelined) {
+      while (!eos && (ret = vorbis_analysis_packetout (&vd, &op)) == 1) {
+        keep_packet (out, &op) ;
+        eos = op.e_o_s ;
+      }
+      if (ret < 0) {
+        printf ("Error : %s vorbis_analysis_packetout returned %d\n", s->name, ret) ;
+        exit (1) ;
+      }
+    } else
+      while (vorbis_analysis_blockout (&vd, &vb) == 1) {
+        vorbis_analysis (&vb, NULL) ;
+        vorbis_bitrate_addblock (&vb) ;
+        while (vorbis_bitrate_flushpacket (&vd, &op)) {
+          keep_packet (out, &op) ;
+          eos = op.e_o_s ;
+        }
+      }
+  }
+
+  vorbis_block_clear (&vb) ;
+  vorbis_dsp_clear (&vd) ;
+  vorbis_comment_clear (&vc) ;
+  vorbis_info_clear (&vi) ;
+}
+
+static int
+compare (const char *what, const packet_list *a, const packet_list *b)
+{
+  long i ;
+
+  printf ("    %-50s : ", what) ;
+  if (a->packets != b->packets) {
+    printf ("Error : %ld packets, expected %ld.\n", b->packets, a->packets) ;
+    return 1 ;
+  }
+  for (i = 0 ; i < a->packets ; i++)
+    if (a->sizes [i] != b->sizes [i] || a->granules [i] != b->granules [i]) {
+      printf ("Error : packet %ld differs.\n", i) ;
+      return 1 ;
+    }
+  if (memcmp (a->data, b->data, a->bytes)) {
+    printf ("Error : packet contents differ.\n") ;
+    return 1 ;
+  }
+  puts ("ok") ;
+  return 0 ;
+}
+
+int
+main (void)
+{
+  static const int threads [] = { 2, 3, 4 } ;
+  unsigned k, t ;
+  int bits, errors = 0 ;
+
+  for (k = 0 ; k < ARRAY_LEN (setups) ; k++) {
+    const encode_setup *s = setups + k ;
+    long frames = s->rate * SECONDS ;
+    float *pcm = make_input (s->channels, s->rate, frames) ;
+    packet_list serial, other ;
+    char what [128] ;
+
+    printf ("\n%s\n\n", s->name) ;
+    encode (s, 1, 0, FEED_BUFFER, pcm, frames, &serial) ;
+
+    /* worker threads: packet blobs and channels on the pool */
+    for (t = 0 ; t < ARRAY_LEN (threads) ; t++) {
+      snprintf (what, sizeof (what), "%d threads", threads [t]) ;
+      encode (s, threads [t], 0, FEED_BUFFER, pcm, frames, &other) ;
+      errors += compare (what, &serial, &other) ;
+      free_packets (&other) ;
+    }
+
+    /* lookups rebuilt from scratch rather than shared */
+    vorbis_cache_clear () ;
+    encode (s, 1, 0, FEED_BUFFER, pcm, frames, &other) ;
+    errors += compare ("after vorbis_cache_clear", &serial, &other) ;
+    free_packets (&other) ;
+
+    /* vorbis_analysis_packetout, one block at a time and batched */
+    for (t = 0 ; t < ARRAY_LEN (threads) + 1 ; t++) {
+      int n = t ? threads [t - 1] : 1 ;
+      snprintf (what, sizeof (what), "vorbis_analysis_packetout, %d thread%s",
+                n, n == 1 ? "" : "s") ;
+      encode (s, n, 1, FEED_BUFFER, pcm, frames, &other) ;
+      errors += compare (what, &serial, &other) ;
+      free_packets (&other) ;
+    }
+
+    /* the interleaved writers against deinterleaving by hand */
+    encode (s, 1, 0, FEED_F32, pcm, frames, &other) ;
+    errors += compare ("vorbis_analysis_write_interleaved_f32", &serial, &other) ;
+    free_packets (&other) ;
+
+    for (bits = 16 ; bits <= 24 ; bits += 8) {
+      void *ints = malloc ((bits / 8) * s->channels * frames) ;
+      float *as_float = malloc (sizeof (*as_float) * s->channels * frames) ;
+      packet_list planar ;
+
+      make_integer_input (pcm, s->channels, frames, bits, ints, as_float) ;
+      encode (s, 1, 0, FEED_BUFFER, as_float, frames, &planar) ;
+      encode (s, 1, 0, bits == 16 ? FEED_S16 : FEED_S24, ints, frames, &other) ;
+      snprintf (what, sizeof (what), "vorbis_analysis_write_interleaved_s%d", bits) ;
+      errors += compare (what, &planar, &other) ;
+      free_packets (&other) ;
+      free_packets (&planar) ;
+      free (as_float) ;
+      free (ints) ;
+    }
+
+    free_packets (&serial) ;
+    free (pcm) ;
+  }
+
+  vorbis_cache_clear () ;
+  if (errors)
+    exit (1) ;
+
+  return 0 ;
+}
@@ -0,0 +1,202 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2015             *
+ * by the Xiph.Org Foundation https://xiph.org/                     *
+ *                                                                  *
+ ********************************************************************
+
+ function: encode time and bitrate for each OV_ECTL_SPEED_SET level
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <vorbis/codec.h>
+#include <vorbis/vorbisenc.h>
+
+#include "util.h"
+
+#ifndef M_PI
+#  define M_PI (3.1415926536f)
+#endif
+
+#define SECONDS   4
+#define CHUNK     1024
+#define LEVELS    4
+
+typedef struct {
+  const char *name ;
+  int channels ;
+  long rate ;
+  float quality ;   /* VBR quality, if bitrate is 0 */
+  long bitrate ;    /* managed nominal bitrate */
+} encode_setup ;
+
+static const encode_setup setups [] = {
+  { "mono 8000 q0.2",            1,  8000, .2f,      0 },
+  { "mono 22050 q0.2",           1, 22050, .2f,      0 },
+  { "stereo 44100 q0.5",         2, 44100, .5f,      0 },
+  { "stereo 44100 managed 128k", 2, 44100, 0.f, 128000 },
+} ;
+
+/* a chord with some vibrato, a noise floor and a burst three times a
+   second */
+static void
+fill (float **buffer, int ch, long rate, long start, long n, unsigned long *seed)
+{
+  long i ;
+  int j ;
+
+  for (i = 0 ; i < n ; i++) {
+    float t = (float) (start + i) / rate ;
+    float tone = .2f * sin (2 * M_PI * 220 * t) + .15f * sin (2 * M_PI * 277 * t)
+      + .1f * sin (2 * M_PI * 330 * (t + .002f * sin (2 * M_PI * 5 * t))) ;
+    float burst = ((start + i) % (rate / 3)) < rate / 50 ? .4f : 0.f ;
+    for (j = 0 ; j < ch ; j++) {
+      float noise ;
+      *seed = *seed * 1664525UL + 1013904223UL ;
+      noise = (float) ((*seed >> 8) & 0xffff) / 32768.f - 1.f ;
+      buffer [j][i] = tone * (1.f - .2f * j) + (.01f + burst) * noise ;
+    }
+  }
+}
+
+/* returns the encoded size in bytes and the encode time in seconds,
+   leaving out making the input and decoding; exits if the stream
+   doesn't decode to the input length */
+static long
+encode (const encode_setup *s, int level, double *seconds)
+{
+  vorbis_info vi, dvi ;
+  vorbis_comment vc, dvc ;
+  vorbis_dsp_state vd, dvd ;
+  vorbis_block vb, dvb ;
+  ogg_packet op, header [3] ;
+  unsigned long seed = 12345 ;
+  long frames = s->rate * SECONDS, done = 0, bytes = 0, decoded = 0 ;
+  clock_t start ;
+  int i, ret, eos = 0 ;
+
+  vorbis_info_init (&vi) ;
+  if (s->bitrate > 0)
+    ret = vorbis_encode_setup_managed (&vi, s->channels, s->rate, -1, s->bitrate, -1) ;
+  else
+    ret = vorbis_encode_setup_vbr (&vi, s->channels, s->rate, s->quality) ;
+  if (ret == 0)
+    ret = vorbis_encode_ctl (&vi, OV_ECTL_SPEED_SET, &level) ;
+  if (ret == 0)
+    ret = vorbis_encode_setup_init (&vi) ;
+  if (ret) {
+    printf ("Error : %s level %d encoder setup returned %d\n", s->name, level, ret) ;
+    exit (1) ;
+  }
+
+  vorbis_comment_init (&vc) ;
+  vorbis_analysis_init (&vd, &vi) ;
+  vorbis_block_init (&vd, &vb) ;
+  vorbis_analysis_headerout (&vd, &vc, header, header + 1, header + 2) ;
+
+  /* the decoder takes the headers before the encoder reuses them */
+  vorbis_info_init (&dvi) ;
+  vorbis_comment_init (&dvc) ;
+  for (i = 0 ; i < 3 ; i++)
+    if (vorbis_synthesis_headerin (&dvi, &dvc, header + i)) {
+      printf ("Error : %s level %d header %d rejected\n", s->name, level, i) ;
+      exit (1) ;
+    }
+  vorbis_synthesis_init (&dvd, &dvi) ;
+  vorbis_block_init (&dvd, &dvb) ;
+
+  *seconds = 0. ;
+  while (!eos) {
+    if (done < frames) {
+      long n = frames - done < CHUNK ? frames - done : CHUNK ;
+      fill (vorbis_analysis_buffer (&vd, n), s->channels, s->rate, done, n, &seed) ;
+      start = clock () ;
+      vorbis_analysis_wrote (&vd, n) ;
+      done += n ;
+    } else {
+      start = clock () ;
+      vorbis_analysis_wrote (&vd, 0) ;
+    }
+
+    while (vorbis_analysis_blockout (&vd, &vb) == 1) {
+      vorbis_analysis (&vb, NULL) ;
+      vorbis_bitrate_addblock (&vb) ;
+      while (vorbis_bitrate_flushpacket (&vd, &op)) {
+        float **pcm ;
+        int n ;
+
+        *seconds += (double) (clock () - start) / CLOCKS_PER_SEC ;
+        bytes += op.bytes ;
+        eos = op.e_o_s ;
+        if (vorbis_synthesis (&dvb, &op) == 0)
+          vorbis_synthesis_blockin (&dvd, &dvb) ;
+        while ((n = vorbis_synthesis_pcmout (&dvd, &pcm)) > 0) {
+          decoded += n ;
+          vorbis_synthesis_read (&dvd, n) ;
+        }
+        start = clock () ;
+      }
+    }
+    *seconds += (double) (clock () - start) / CLOCKS_PER_SEC ;
+  }
+
+  if (decoded != frames) {
+    printf ("Error : %s level %d decoded %ld of %ld frames\n",
+            s->name, level, decoded, frames) ;
+    exit (1) ;
+  }
+
+  vorbis_block_clear (&dvb) ;
+  vorbis_dsp_clear (&dvd) ;
+  vorbis_comment_clear (&dvc) ;
+  vorbis_info_clear (&dvi) ;
+  vorbis_block_clear (&vb) ;
+  vorbis_dsp_clear (&vd) ;
+  vorbis_comment_clear (&vc) ;
+  vorbis_info_clear (&vi) ;
+  return bytes ;
+}
+
+int
+main (void)
+{
+  double total [LEVELS], kbps [LEVELS] ;
+  unsigned k ;
+  int level ;
+
+  memset (total, 0, sizeof (total)) ;
+  memset (kbps, 0, sizeof (kbps)) ;
+
+  printf ("\n    %-28s level  encode s  x realtime   kbps\n", "") ;
+  for (k = 0 ; k < ARRAY_LEN (setups) ; k++)
+    for (level = 0 ; level < LEVELS ; level++) {
+      double seconds ;
+      long bytes = encode (setups + k, level, &seconds) ;
+      double rate = bytes * 8. / SECONDS / 1000. ;
+
+      printf ("    %-28s %5d  %8.3f  %10.1f  %6.1f\n",
+              level ? "" : setups [k].name, level, seconds,
+              seconds > 0. ? SECONDS / seconds : 0., rate) ;
+      total [level] += seconds ;
+      kbps [level] += rate ;
+    }
+
+  printf ("\n    %-28s level  encode s  vs level 0  sum of kbps\n", "all setups") ;
+  for (level = 0 ; level < LEVELS ; level++)
+    printf ("    %-28s %5d  %8.3f  %10.2f  %11.1f\n", "", level, total [level],
+            total [level] > 0. ? total [0] / total [level] : 0., kbps [level]) ;
+
+  vorbis_cache_clear () ;
+  return 0 ;
+}